@@ -1,9 +1,11 @@
 #ifndef DISCORD_ALIASES_H
 #define DISCORD_ALIASES_H
 
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/websocket/ssl.hpp>
 
@@ -13,4 +15,8 @@ using udp = boost::asio::ip::udp;
 using ssl_stream = ssl::stream<tcp::socket>;
 using secure_websocket = boost::beast::websocket::stream<ssl_stream>;
 
+// The io_context runs on several threads. Everything of the main gateway, and of each guild's
+// voice connection, runs on its own strand so their handlers never run concurrently
+using io_strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+
 #endif
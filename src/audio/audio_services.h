@@ -0,0 +1,22 @@
+#ifndef AUDIO_AUDIO_SERVICES_H
+#define AUDIO_AUDIO_SERVICES_H
+
+#include <boost/asio/thread_pool.hpp>
+
+#include "audio/frame_queue.h"
+#include "audio/track_cache.h"
+#include "audio/track_lru.h"
+#include "net/udp_transport.h"
+#include "voice/audio_clock.h"
+
+// Shared by every voice_context, owned by main
+struct audio_services {
+    boost::asio::thread_pool &pool;  // Decodes and encodes audio, off the io threads
+    lookahead_options lookahead;
+    const track_cache &disk_cache;
+    track_lru &memory_cache;
+    discord::audio_clock &clock;        // Paces the frames sent by every guild
+    discord::udp_transport &transport;  // Sends them, batched
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include <iostream>
+
+#include "audio/cached_source.h"
+
+cached_source::cached_source(const std::string &file_path, error_cb on_ready)
+    : file_path{file_path}
+    , on_ready{std::move(on_ready)}
+    , header{nullptr}
+    , frames{nullptr}
+    , payload{nullptr}
+    , next_frame{0}
+{
+    std::cout << "[cached source] playing " << file_path << "\n";
+}
+
+opus_frame cached_source::next()
+{
+    if (next_frame >= header->frame_count)
+        return opus_frame::source_end();
+
+    // The lookup only checked the header, the index is checked as it's used
+    auto encoded = frames[next_frame++];
+    if (!track_cache::check_frame(*header, encoded)) {
+        std::cerr << "[cached source] " << file_path << " has a damaged frame\n";
+        return opus_frame::source_end();
+    }
+    auto frame = opus_frame{};
+    frame.assign(payload + encoded.offset, encoded.size);
+    frame.frame_count = encoded.frame_count;
+    frame.end_of_source = next_frame == header->frame_count;
+    return frame;
+}
+
+bool cached_source::seek(std::chrono::milliseconds position)
+{
+    // Walk the index up to the frame playing at position
+    auto target = position.count() * 48;
+    auto samples = int64_t{0};
+    auto i = uint32_t{0};
+    while (i < header->frame_count && samples + frames[i].frame_count <= target)
+        samples += frames[i++].frame_count;
+
+    if (i == header->frame_count)
+        return false;
+    next_frame = i;
+    return true;
+}
+
+void cached_source::prepare()
+{
+    namespace bip = boost::interprocess;
+    auto error = make_error_code(boost::system::errc::io_error);
+
+    try {
+        mapping = bip::file_mapping{file_path.c_str(), bip::read_only};
+        region = bip::mapped_region{mapping, bip::read_only};
+        region.advise(bip::mapped_region::advice_sequential);
+    } catch (bip::interprocess_exception &e) {
+        std::cerr << "[cached source] could not map " << file_path << ": " << e.what() << "\n";
+        on_ready(error);
+        return;
+    }
+
+    // Make sure the index and payload the header describes are all there
+    auto base = static_cast<const uint8_t *>(region.get_address());
+    auto size = region.get_size();
+    if (size >= sizeof(track_file_header)) {
+        header = reinterpret_cast<const track_file_header *>(base);
+        auto index_size = size_t{header->frame_count} * sizeof(encoded_frame);
+        if (track_cache::check_header(*header) &&
+            size >= sizeof(track_file_header) + index_size + header->payload_size) {
+            frames = reinterpret_cast<const encoded_frame *>(base + sizeof(track_file_header));
+            payload = base + sizeof(track_file_header) + index_size;
+            error = {};
+        }
+    }
+    if (error)
+        std::cerr << "[cached source] " << file_path << " is not a cached track\n";
+    on_ready(error);
+}
@@ -0,0 +1,35 @@
+#ifndef AUDIO_CACHED_SOURCE_H
+#define AUDIO_CACHED_SOURCE_H
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <string>
+
+#include "audio/source.h"
+#include "audio/track_cache.h"
+#include "callbacks.h"
+
+// Plays a track from the track_cache. Its frames are already encoded, they are handed out
+// straight from the memory mapped file
+class cached_source : public audio_source
+{
+public:
+    cached_source(const std::string &file_path, error_cb on_ready);
+    virtual ~cached_source() = default;
+    virtual opus_frame next();
+    virtual bool seek(std::chrono::milliseconds position);
+    virtual void prepare();
+
+private:
+    std::string file_path;
+    error_cb on_ready;
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
+
+    const track_file_header *header;
+    const encoded_frame *frames;
+    const uint8_t *payload;
+    uint32_t next_frame;
+};
+
+#endif
@@ -1,57 +1,210 @@
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <memory>
 #include <vector>
 
+#include <opus/opus.h>
+
 #include "decoding.h"
 
+buffer_data::buffer_data(size_t capacity)
+    : data(capacity), start{0}, held{0}, loc{0}, offset{0}, retain{true}
+{
+}
+
+size_t buffer_data::space()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return data.size() - held;
+}
+
+size_t buffer_data::size()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return held;
+}
+
+size_t buffer_data::buffered()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return held - loc;
+}
+
+std::array<buffer_region, 2> buffer_data::prepare(size_t bytes)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    bytes = std::min(bytes, data.size() - held);
+    auto end = (start + held) % data.size();
+    auto first = std::min(bytes, data.size() - end);
+    return {{{&data[end], first}, {data.data(), bytes - first}}};
+}
+
+void buffer_data::commit(size_t bytes)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    assert(bytes <= data.size() - held);
+    held += bytes;
+}
+
+size_t buffer_data::read(uint8_t *dest, size_t bytes)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    bytes = std::min(bytes, held - loc);
+    if (bytes == 0)
+        return 0;
+
+    // Unread data is in at most two pieces, when it wraps around the end of storage
+    auto from = (start + loc) % data.size();
+    auto first = std::min(bytes, data.size() - from);
+    memcpy(dest, &data[from], first);
+    memcpy(dest + first, data.data(), bytes - first);
+    loc += bytes;
+
+    if (!retain)
+        consume();
+    return bytes;
+}
+
+// Streamed input can only be seeked within what is still buffered: anything read while probing,
+// and what has arrived but not been read yet
+int64_t buffer_data::seek(int64_t to, int whence)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto pos = int64_t{0};
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            pos = to;
+            break;
+        case SEEK_CUR:
+            pos = static_cast<int64_t>(offset + loc) + to;
+            break;
+        default:
+            // Includes AVSEEK_SIZE, the size of a stream isn't known
+            return -1;
+    }
+    auto first = static_cast<int64_t>(offset);
+    if (pos < first || pos > first + static_cast<int64_t>(held))
+        return -1;
+    loc = static_cast<size_t>(pos - first);
+    return pos;
+}
+
+void buffer_data::rewind()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    loc = 0;
+}
+
+void buffer_data::release()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    retain = false;
+    consume();
+}
+
+void buffer_data::clear()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    offset += held;
+    start = held = loc = 0;
+}
+
+void buffer_data::consume()
+{
+    offset += loc;
+    start = (start + loc) % data.size();
+    held -= loc;
+    loc = 0;
+}
+
 // Some data has been requested, write the results into buf, return the amount of bytes written
 static int read_packet(void *opaque, uint8_t *buf, int buf_size)
 {
     assert(opaque);
     auto bd = reinterpret_cast<buffer_data *>(opaque);
-    buf_size = std::min<int>(buf_size, bd->data.size() - bd->loc);
-    if (buf_size < 0)
+    if (buf_size <= 0)
         return 0;
-    memcpy(buf, &bd->data[bd->loc], buf_size);
-    bd->loc += buf_size;
-    return buf_size;
+    return static_cast<int>(bd->read(buf, static_cast<size_t>(buf_size)));
 }
 
-#if 0
-static int64_t seek(void *opaque, int64_t offset, int whence)
+static int64_t seek_packet(void *opaque, int64_t offset, int whence)
 {
     assert(opaque);
-    auto bd = reinterpret_cast<buffer_data *>(opaque);
-    switch (whence) {
+    return reinterpret_cast<buffer_data *>(opaque)->seek(offset, whence);
+}
+
+// Memory input is all there, read from wherever the demuxer last seeked to
+static int read_memory(void *opaque, uint8_t *buf, int buf_size)
+{
+    assert(opaque);
+    auto md = reinterpret_cast<memory_data *>(opaque);
+    auto read = std::min<size_t>(std::max(buf_size, 0), md->size - md->loc);
+    if (read == 0)
+        return AVERROR_EOF;
+    memcpy(buf, md->data + md->loc, read);
+    md->loc += read;
+    return static_cast<int>(read);
+}
+
+static int64_t seek_memory(void *opaque, int64_t offset, int whence)
+{
+    assert(opaque);
+    auto md = reinterpret_cast<memory_data *>(opaque);
+    auto pos = int64_t{0};
+    switch (whence & ~AVSEEK_FORCE) {
         case SEEK_SET:
-            return bd->loc = offset;
+            pos = offset;
+            break;
         case SEEK_CUR:
-            return bd->loc += offset;
+            pos = static_cast<int64_t>(md->loc) + offset;
+            break;
         case SEEK_END:
-            return bd->loc = bd->data.size() + offset;
+            pos = static_cast<int64_t>(md->size) + offset;
+            break;
         case AVSEEK_SIZE:
-            return bd->data.size();
+            return static_cast<int64_t>(md->size);
+        default:
+            return -1;
     }
-    return -1;
+    if (pos < 0 || pos > static_cast<int64_t>(md->size))
+        return -1;
+    md->loc = static_cast<size_t>(pos);
+    return pos;
 }
-#endif
 
-avio_context::avio_context(std::vector<uint8_t> &audio_data) : audio_file_data{audio_data, 0}
+avio_context::avio_context(buffer_data &audio_data, const avio_options &options)
 {
-    avio_buf_len = 8192;
+    allocate(&audio_data, &read_packet, &seek_packet, options);
+
+    // Don't let demuxers rely on seeking, they would try to jump to indexes at the end of the
+    // stream. Short seeks within the buffer still go through seek_packet
+    avio_ctx->seekable = 0;
+}
+
+avio_context::avio_context(memory_data &audio_data, const avio_options &options)
+{
+    allocate(&audio_data, &read_memory, &seek_memory, options);
+}
+
+void avio_context::allocate(void *opaque, int (*read)(void *, uint8_t *, int),
+                            int64_t (*seek)(void *, int64_t, int), const avio_options &options)
+{
+    avio_buf_len = options.buffer_size;
     avio_buf = reinterpret_cast<uint8_t *>(av_malloc(avio_buf_len));
     if (!avio_buf)
         throw std::runtime_error{"Could not allocate avio context buffer"};
 
     // Instead of using avformat_open_input and passing path, we're going to use AVIO
     // which allows us to point to an already allocated area of memory that contains the media
-    avio_ctx = avio_alloc_context(avio_buf, avio_buf_len, 0, &audio_file_data, &read_packet,
-                                  nullptr, nullptr);
+    avio_ctx = avio_alloc_context(avio_buf, avio_buf_len, 0, opaque, read, nullptr, seek);
     if (!avio_ctx)
         throw std::runtime_error{"Could not allocate AVIO context"};
+
+    // Reads larger than the AVIO buffer skip it, and are copied from our input into the packet
+    avio_ctx->direct = options.direct;
 }
 
 avio_context::~avio_context()
@@ -72,6 +225,7 @@ audio_decoder::audio_decoder()
     , do_output{true}
     , flushed{false}
     , eof{false}
+    , held_packet{false}
 {
     if (!frame)
         throw std::runtime_error{"Unable to allocate audio frame"};
@@ -93,7 +247,7 @@ audio_decoder::~audio_decoder()
         av_packet_unref(&packet);
 }
 
-void audio_decoder::open_input(avio_context &av)
+void audio_decoder::open_input(avio_context &av, int64_t probe_size)
 {
     format_context = avformat_alloc_context();
     if (!format_context)
@@ -102,6 +256,11 @@ void audio_decoder::open_input(avio_context &av)
     // Use the AVIO context
     format_context->pb = av.avio_ctx;
 
+    // Don't let find_stream_info read past the data we have, a streamed input could still be
+    // downloading the rest
+    if (probe_size > 0)
+        format_context->probesize = probe_size;
+
     // Open the file, read the header, export information into format_context
     // Frees format_context on failure
     if (avformat_open_input(&format_context, "audio-stream", nullptr, nullptr) != 0)
@@ -233,8 +392,85 @@ void audio_decoder::decode_frame()
     }
 }
 
+bool audio_decoder::seek(std::chrono::milliseconds position, std::chrono::microseconds &landed)
+{
+    auto stream = format_context->streams[stream_index];
+    auto start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    auto timestamp = start + av_rescale_q(position.count(), AVRational{1, 1000}, stream->time_base);
+    if (av_seek_frame(format_context, stream_index, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+        return false;
+
+    // Drop anything decoded from before the seek, the codec can be used again even if it was
+    // drained at the end of the stream
+    avcodec_flush_buffers(decoder_context);
+    if (packet.buf)
+        av_packet_unref(&packet);
+    if (!frame) {
+        frame = av_frame_alloc();
+        if (!frame)
+            throw std::runtime_error{"Unable to allocate audio frame"};
+    }
+    do_read = true;
+    do_feed = true;
+    do_output = true;
+    flushed = false;
+    eof = false;
+
+    // The first packet after the seek says where the demuxer actually landed, it is kept for
+    // next_frame() or next_packet()
+    landed = std::chrono::duration_cast<std::chrono::microseconds>(position);
+    held_packet = false;
+    av_init_packet(&packet);
+    while (av_read_frame(format_context, &packet) == 0) {
+        if (packet.stream_index == stream_index) {
+            held_packet = true;
+            break;
+        }
+        av_packet_unref(&packet);
+    }
+    if (!held_packet)
+        return true;  // Seeked to the end, reading again finds that out
+
+    do_read = false;
+    auto pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+    if (pts != AV_NOPTS_VALUE)
+        landed = std::chrono::microseconds{
+            av_rescale_q(pts - start, stream->time_base, AVRational{1, 1000000})};
+    return true;
+}
+
+AVPacket *audio_decoder::next_packet()
+{
+    if (held_packet) {
+        held_packet = false;
+        return &packet;
+    }
+    if (packet.buf)
+        av_packet_unref(&packet);
+
+    av_init_packet(&packet);
+    while (av_read_frame(format_context, &packet) == 0) {
+        if (packet.stream_index == stream_index)
+            return &packet;
+        av_packet_unref(&packet);
+    }
+    return nullptr;
+}
+
+const AVCodecParameters *audio_decoder::codec_parameters() const
+{
+    return format_context->streams[stream_index]->codecpar;
+}
+
+int64_t audio_decoder::bit_rate() const
+{
+    auto codecpar = codec_parameters();
+    return codecpar->bit_rate > 0 ? codecpar->bit_rate : format_context->bit_rate;
+}
+
 audio_frame audio_decoder::next_frame()
 {
+    held_packet = false;
     if (do_read)
         read_packet();
 
@@ -344,19 +580,71 @@ int audio_resampler<T, format, sample_rate, channels>::delayed_samples()
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
-simple_audio_decoder<T, format, sample_rate, channels>::simple_audio_decoder()
-    : avio{input_buffer}, state{decoder_state::start}
+simple_audio_decoder<T, format, sample_rate, channels>::simple_audio_decoder(avio_options options)
+    : input{input_capacity}
+    , memory{nullptr, 0, 0}
+    , use_memory{false}
+    , options{options}
+    , probe_size{initial_probe_size}
+    , input_closed{false}
+    , samples_read{0}
+    , skip_samples{0}
+    , state{decoder_state::start}
 {
     static_assert(sample_rate > 0);
     static_assert(channels > 0);
+    reset();
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
-void simple_audio_decoder<T, format, sample_rate, channels>::feed(const uint8_t *data, size_t bytes)
+size_t simple_audio_decoder<T, format, sample_rate, channels>::feed(const uint8_t *data,
+                                                                   size_t bytes)
 {
-    if (data && bytes > 0) {
-        input_buffer.insert(input_buffer.end(), data, data + bytes);
+    if (!data)
+        return 0;
+
+    auto fed = size_t{0};
+    for (auto region : input.prepare(bytes)) {
+        memcpy(region.data, data + fed, region.size);
+        fed += region.size;
     }
+    input.commit(fed);
+    return fed;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+size_t simple_audio_decoder<T, format, sample_rate, channels>::space()
+{
+    return input.space();
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+std::array<buffer_region, 2> simple_audio_decoder<T, format, sample_rate, channels>::prepare(
+    size_t bytes)
+{
+    return input.prepare(bytes);
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void simple_audio_decoder<T, format, sample_rate, channels>::commit(size_t bytes)
+{
+    input.commit(bytes);
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void simple_audio_decoder<T, format, sample_rate, channels>::set_input(const uint8_t *data,
+                                                                      size_t size)
+{
+    memory = {data, size, 0};
+    use_memory = true;
+    input_closed = true;
+    reset();
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void simple_audio_decoder<T, format, sample_rate, channels>::close_input()
+{
+    input_closed = true;
 }
 
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
@@ -365,37 +653,127 @@ int simple_audio_decoder<T, format, sample_rate, channels>::read(T *data, int sa
     assert(data);
     assert(samples > 0);
 
-    if (state != decoder_state::eof) {
-        auto avf = decoder.next_frame();
-        if (avf.data) {
-            resampler->feed(&avf);
-        }
-        if (avf.eof) {
-            state = decoder_state::eof;
-            resampler->feed(nullptr);
+    // Finish a forward seek in streamed input by throwing away samples up to its position
+    while (skip_samples > 0) {
+        auto wanted = static_cast<int>(std::min<int64_t>(skip_samples, samples));
+        if (!decode(wanted))
+            return 0;
+        auto audio = resampler->read(wanted);
+        if (audio.frame_count <= 0) {
+            skip_samples = 0;  // Seeked past the end
+            break;
         }
+        skip_samples -= audio.frame_count;
+        samples_read += audio.frame_count;
     }
 
+    // Underrun, the rest of the stream hasn't arrived yet
+    if (!decode(samples))
+        return 0;
+
     auto audio = resampler->read(samples);
     if (audio.frame_count > 0) {
         auto start = audio.data;
         auto end = audio.data + audio.frame_count * channels;
         std::copy(start, end, data);
-
-        if (state != decoder_state::eof && audio.frame_count < samples) {
-            // try to read the remaining samples
-            return audio.frame_count +
-                   read(data + audio.frame_count * channels, samples - audio.frame_count);
-        }
+        samples_read += audio.frame_count;
     }
 
     if (audio.frame_count <= 0 && state == decoder_state::eof) {
         // decoder gave eof and resampler isn't giving more data... completely done
-        input_buffer.clear();
+        input.clear();
     }
     return audio.frame_count;
 }
 
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::can_passthrough(int64_t max_bit_rate)
+{
+    if (state != decoder_state::ready)
+        return false;
+
+    // Opus is always 48kHz, but a stream with more channels than ours needs to be downmixed. The
+    // bit rate of a streamed webm is unknown (0), youtube-dl's formats are picked to fit anyway
+    auto codecpar = decoder->codec_parameters();
+    auto bit_rate = decoder->bit_rate();
+    return codecpar->codec_id == AV_CODEC_ID_OPUS && sample_rate == 48000 &&
+           codecpar->channels <= channels && bit_rate <= max_bit_rate;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+audio_packet simple_audio_decoder<T, format, sample_rate, channels>::read_packet()
+{
+    while (state == decoder_state::ready && can_decode()) {
+        auto packet = decoder->next_packet();
+        if (!packet) {
+            state = decoder_state::eof;
+            input.clear();
+            break;
+        }
+
+        auto frame_count = opus_packet_get_nb_samples(packet->data, packet->size, 48000);
+        if (frame_count <= 0)
+            continue;  // Corrupt packet, leave it out
+
+        // Seeks drop whole packets up to the position
+        samples_read += frame_count;
+        if (skip_samples > 0) {
+            skip_samples -= frame_count;
+            continue;
+        }
+        return {packet->data, packet->size, frame_count};
+    }
+    return {nullptr, 0, 0};
+}
+
+// Decode until the resampler can hand out the requested samples, without letting the demuxer run
+// into the end of what has been fed so far. Returns false if the input ran dry first
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::decode(int samples)
+{
+    while (state != decoder_state::eof && resampler->delayed_samples() < samples && can_decode()) {
+        auto avf = decoder->next_frame();
+        if (avf.data) {
+            resampler->feed(&avf);
+        }
+        if (avf.eof) {
+            state = decoder_state::eof;
+            resampler->feed(nullptr);
+        }
+    }
+    return state == decoder_state::eof || resampler->delayed_samples() >= samples;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::seek(
+    std::chrono::milliseconds position)
+{
+    if (state != decoder_state::ready && state != decoder_state::eof)
+        return false;
+
+    auto target = position.count() * sample_rate / 1000;
+    if (use_memory) {
+        auto landed = std::chrono::microseconds{};
+        if (!decoder->seek(position, landed))
+            return false;
+
+        // Throw away whatever the resampler still holds from before the seek. The demuxer
+        // landed at or before position, decoding skips up to it
+        resampler = std::make_unique<resampler_type>(*decoder);
+        state = decoder_state::ready;
+        samples_read = landed.count() * sample_rate / 1000000;
+        skip_samples = std::max<int64_t>(target - samples_read, 0);
+        return true;
+    }
+
+    // Streamed input has already been dropped up to the current position, and can only be
+    // decoded forward
+    if (state == decoder_state::eof || target < samples_read)
+        return false;
+    skip_samples = target - samples_read;
+    return true;
+}
+
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
 int simple_audio_decoder<T, format, sample_rate, channels>::available()
 {
@@ -404,6 +782,14 @@ int simple_audio_decoder<T, format, sample_rate, channels>::available()
     return 0;
 }
 
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+size_t simple_audio_decoder<T, format, sample_rate, channels>::buffered()
+{
+    if (use_memory)
+        return memory.size - memory.loc;
+    return input.buffered();
+}
+
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
 bool simple_audio_decoder<T, format, sample_rate, channels>::ready()
 {
@@ -416,32 +802,82 @@ bool simple_audio_decoder<T, format, sample_rate, channels>::done()
     return state == decoder_state::eof;
 }
 
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::failed()
+{
+    return state == decoder_state::error;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+bool simple_audio_decoder<T, format, sample_rate, channels>::can_decode()
+{
+    return input_closed || buffered() >= min_read_ahead;
+}
+
+template<typename T, AVSampleFormat format, int sample_rate, int channels>
+void simple_audio_decoder<T, format, sample_rate, channels>::reset()
+{
+    // The demuxer has to be destroyed before the AVIO context it reads from
+    resampler.reset();
+    decoder.reset();
+
+    // Start reading from the beginning of the stream again
+    if (use_memory) {
+        memory.loc = 0;
+        avio = std::make_unique<avio_context>(memory, options);
+    } else {
+        input.rewind();
+        avio = std::make_unique<avio_context>(input, options);
+    }
+    decoder = std::make_unique<audio_decoder>();
+    state = decoder_state::start;
+}
+
 template<typename T, AVSampleFormat format, int sample_rate, int channels>
 void simple_audio_decoder<T, format, sample_rate, channels>::check_stream()
 {
+    if (state == decoder_state::ready || state == decoder_state::eof ||
+        state == decoder_state::error)
+        return;
+
+    // Wait for enough of the stream to arrive, probing reads everything up to probe_size
+    if (!input_closed && input.size() < probe_size)
+        return;
+
     try {
         switch (state) {
             // yes, fall through
             case decoder_state::start:
-                decoder.open_input(avio);
+                // Probing can use all of the input once it's complete
+                decoder->open_input(*avio, input_closed ? 0 : static_cast<int64_t>(probe_size));
                 state = decoder_state::opened_input;
             case decoder_state::opened_input:
-                decoder.find_stream_info();
+                decoder->find_stream_info();
                 state = decoder_state::found_stream_info;
             case decoder_state::found_stream_info:
-                decoder.find_best_stream();
+                decoder->find_best_stream();
                 state = decoder_state::found_best_stream;
             case decoder_state::found_best_stream:
-                decoder.open_decoder();
+                decoder->open_decoder();
                 state = decoder_state::opened_decoder;
             case decoder_state::opened_decoder:
-                resampler = std::make_unique<resampler_type>(decoder);
+                resampler = std::make_unique<resampler_type>(*decoder);
                 state = decoder_state::ready;
+
+                // Probing won't start over anymore, let the ring drop what has been demuxed
+                input.release();
             default:
                 break;
         }
     } catch (std::exception &e) {
+        if (!input_closed && probe_size < input_capacity) {
+            // The header might not have fit in what we had, start over with more data
+            probe_size *= 2;
+            reset();
+            return;
+        }
         std::cerr << e.what() << "\n";
+        state = decoder_state::error;
     }
 }
 
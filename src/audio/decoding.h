@@ -1,7 +1,11 @@
 #ifndef DECODING_H
 #define DECODING_H
 
-#include <boost/circular_buffer.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 extern "C" {
@@ -14,16 +18,68 @@ extern "C" {
 
 class audio_decoder;
 
-struct buffer_data {
-    std::vector<uint8_t> &data;
+// Contiguous run of bytes inside a buffer_data
+struct buffer_region {
+    uint8_t *data;
+    size_t size;
+};
+
+// Bounded FIFO of input waiting for the demuxer. Producers write straight into the free space
+// handed out by prepare() and publish it with commit(), so the input is never staged elsewhere.
+// Consumed bytes are dropped right away, unless they're retained so probing can start over from
+// the beginning of the stream. The producer and the demuxer may be on different threads
+class buffer_data
+{
+public:
+    explicit buffer_data(size_t capacity);
+    size_t space();
+    size_t size();      // Bytes held, including retained ones that have been read
+    size_t buffered();  // Bytes that haven't been read yet
+    std::array<buffer_region, 2> prepare(size_t bytes);
+    void commit(size_t bytes);
+    size_t read(uint8_t *dest, size_t bytes);
+    int64_t seek(int64_t offset, int whence);
+    void rewind();   // Read from the oldest retained byte again
+    void release();  // Stop retaining, dropping everything read so far
+    void clear();
+
+private:
+    std::mutex mutex;
+    std::vector<uint8_t> data;  // Fixed size storage, wraps around
+    size_t start;               // Index of the oldest byte in data
+    size_t held;                // Committed bytes after start
+    size_t loc;                 // Read position, relative to start
+    size_t offset;              // Position of start in the stream
+    bool retain;
+
+    void consume();  // Drops the bytes before loc
+};
+
+// Input that is entirely in memory, e.g. a memory mapped file. Unlike a buffer_data the demuxer
+// can seek anywhere in it
+struct memory_data {
+    const uint8_t *data;
+    size_t size;
     size_t loc;
 };
 
+struct avio_options {
+    int buffer_size = 8192;  // Size of libavformat's read buffer
+    bool direct = true;      // Large reads go straight from the input into the demuxer's packets
+};
+
 struct audio_frame {
     AVFrame *data;
     bool eof;
 };
 
+// A packet of the stream as it was demuxed, valid until the next packet is read
+struct audio_packet {
+    const uint8_t *data;
+    int size;
+    int frame_count;  // Samples per channel at 48kHz
+};
+
 template<typename T>
 struct audio_samples {
     T *data;
@@ -33,15 +89,18 @@ struct audio_samples {
 class avio_context
 {
 public:
-    avio_context(std::vector<uint8_t> &audio_data);
+    avio_context(buffer_data &audio_data, const avio_options &options);
+    avio_context(memory_data &audio_data, const avio_options &options);
     ~avio_context();
 
 private:
     AVIOContext *avio_ctx;
     uint8_t *avio_buf;
-    buffer_data audio_file_data;
     size_t avio_buf_len;
 
+    void allocate(void *opaque, int (*read)(void *, uint8_t *, int),
+                  int64_t (*seek)(void *, int64_t, int), const avio_options &options);
+
     friend class audio_decoder;
 };
 
@@ -71,12 +130,23 @@ class audio_decoder
 public:
     audio_decoder();
     ~audio_decoder();
-    void open_input(avio_context &av);
+    void open_input(avio_context &av, int64_t probe_size);
     void find_stream_info();
     void find_best_stream();
     void open_decoder();
     audio_frame next_frame();  // Get next frame from the audio stream
 
+    // Get the next packet of the audio stream without decoding it, nullptr at the end of the
+    // stream. Don't mix with next_frame()
+    AVPacket *next_packet();
+    const AVCodecParameters *codec_parameters() const;
+    int64_t bit_rate() const;  // 0 if the container doesn't say
+
+    // Seeks the demuxer to the closest packet before position and flushes the codec. Only for
+    // input that can be seeked anywhere, returns false if the demuxer couldn't seek. landed is
+    // where that packet starts, which can be well before position, e.g. at a keyframe or page
+    bool seek(std::chrono::milliseconds position, std::chrono::microseconds &landed);
+
 private:
     friend float_resampler;
     friend s16_resampler;
@@ -92,6 +162,7 @@ private:
     bool do_output;
     bool flushed;
     bool eof;
+    bool held_packet;  // The packet read by seek() hasn't been handed out yet
 
     void read_packet();
     void feed_decoder();
@@ -103,22 +174,67 @@ template<typename T, AVSampleFormat format, int sample_rate, int channels>
 class simple_audio_decoder
 {
 public:
-    simple_audio_decoder();
+    simple_audio_decoder(avio_options options = {});
     ~simple_audio_decoder() = default;
-    void feed(const uint8_t *data, size_t bytes);
+    size_t feed(const uint8_t *data, size_t bytes);  // Returns the bytes accepted, at most space()
+    size_t space();
+
+    // Zero-copy alternative to feed(): write into the returned regions, then commit what was
+    // written. Only one prepare() may be outstanding
+    std::array<buffer_region, 2> prepare(size_t bytes);
+    void commit(size_t bytes);
+
+    // Decode from memory that stays valid for the decoder's lifetime instead of fed input. The
+    // demuxer reads (and seeks) in it directly, nothing is copied into the input buffer
+    void set_input(const uint8_t *data, size_t size);
+
+    void close_input();  // No more data will be fed, the demuxer may read to the end
     int read(T *data, int samples);
+
+    // True if the stream is opus that can be sent as it is, at no more than max_bit_rate. Its
+    // packets can then be read with read_packet() instead of decoding them with read()
+    bool can_passthrough(int64_t max_bit_rate);
+    audio_packet read_packet();  // Empty packet if the input ran dry or the stream is done()
+
+    // Moves playback to position. Memory input is seeked directly, streamed input can only skip
+    // ahead by decoding up to position. Returns false if the position can't be reached
+    bool seek(std::chrono::milliseconds position);
+
     int available();
+    size_t buffered();  // Bytes fed that the demuxer has not consumed yet
     bool ready();
     bool done();
+    bool failed();
+
+    // Probes the stream once enough input has been fed (or the input is closed). Can be called
+    // repeatedly while streaming, until ready() or failed()
     void check_stream();
 
 private:
     using resampler_type = audio_resampler<T, format, sample_rate, channels>;
 
-    std::vector<uint8_t> input_buffer;
+    // Input is buffered up to this size, producers have to wait for space() to feed more
+    static constexpr size_t input_capacity = 256 * 1024;
+
+    // Probing starts with this much input, doubling on failure until the input buffer is full
+    static constexpr size_t initial_probe_size = 64 * 1024;
+
+    // The demuxer treats a short read as the end of the stream, so it is only asked for more
+    // packets while at least this much unread input is buffered
+    static constexpr size_t min_read_ahead = 32 * 1024;
 
-    avio_context avio;
-    audio_decoder decoder;
+    buffer_data input;
+    memory_data memory;
+    bool use_memory;
+    avio_options options;
+    size_t probe_size;
+    std::atomic<bool> input_closed;
+
+    int64_t samples_read;  // Position decoding has got to, in samples, skipped ones included
+    int64_t skip_samples;  // Left to drop before reaching the position of a seek
+
+    std::unique_ptr<avio_context> avio;
+    std::unique_ptr<audio_decoder> decoder;
     std::unique_ptr<resampler_type> resampler;
 
     enum class decoder_state {
@@ -128,8 +244,13 @@ private:
         found_best_stream,
         opened_decoder,
         ready,
-        eof
+        eof,
+        error
     } state;
+
+    bool can_decode();
+    bool decode(int samples);
+    void reset();
 };
 
 using float_audio_decoder = simple_audio_decoder<float, AV_SAMPLE_FMT_FLT, 48000, 2>;
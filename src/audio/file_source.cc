@@ -1,40 +1,53 @@
 #include <boost/asio/post.hpp>
-#include <fstream>
 #include <iostream>
 
 #include "audio/file_source.h"
 
-file_source::file_source(discord::voice_context &voice_context, const std::string &file_path)
-    : voice_context{voice_context}, file_path{file_path}
+file_source::file_source(source_context context, const std::string &file_path)
+    : context{std::move(context)}, file_path{file_path}, passthrough{false}
 {
     std::cout << "[file source] playing " << file_path << "\n";
 }
 
 opus_frame file_source::next()
 {
-    return next_frame(decoder, voice_context.get_encoder(), buffer.data(), buffer.size());
+    if (passthrough)
+        return next_packet(decoder);
+    return next_frame(decoder, context.encoder, buffer.data(), buffer.size());
+}
+
+bool file_source::seek(std::chrono::milliseconds position)
+{
+    return decoder.seek(position);
 }
 
 void file_source::prepare()
 {
-    auto read = 0;
-    auto ifs = std::ifstream{file_path};
+    namespace bip = boost::interprocess;
     auto error = boost::system::error_code{};
-    if (!ifs) {
+
+    // Map the file instead of reading it, pages are only read in as the demuxer gets to them and
+    // guilds playing the same file share them through the page cache
+    try {
+        mapping = bip::file_mapping{file_path.c_str(), bip::read_only};
+        region = bip::mapped_region{mapping, bip::read_only};
+        region.advise(bip::mapped_region::advice_sequential);
+    } catch (bip::interprocess_exception &e) {
+        std::cerr << "[file source] could not map " << file_path << ": " << e.what() << "\n";
         error = make_error_code(boost::system::errc::io_error);
-        voice_context.notify_audio_source_ready(error);
+        context.on_ready(error);
         return;
     }
-    auto buf = std::array<char, 4096>{};
-    while (ifs.good()) {
-        ifs.read(buf.data(), buf.size());
-        read += ifs.gcount();
-        decoder.feed(reinterpret_cast<uint8_t *>(buf.data()), ifs.gcount());
-    }
-    std::cout << "[file source] read " << read << " bytes\n";
+
+    decoder.set_input(static_cast<const uint8_t *>(region.get_address()), region.get_size());
     decoder.check_stream();
     if (!decoder.ready())
         error = make_error_code(boost::system::errc::io_error);
 
-    voice_context.notify_audio_source_ready(error);
+    // Opus files that fit the channel's bitrate don't need to be transcoded
+    passthrough = decoder.can_passthrough(context.bitrate);
+    if (passthrough)
+        std::cout << "[file source] passing opus through without transcoding\n";
+
+    context.on_ready(error);
 }
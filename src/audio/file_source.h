@@ -2,29 +2,33 @@
 #define AUDIO_FILE_SOURCE_H
 
 #include <boost/asio/io_context.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <string>
 
 #include "audio/decoding.h"
 #include "audio/opus_encoder.h"
 #include "audio/source.h"
-#include "callbacks.h"
-#include "discord.h"
-#include "voice/voice_connector.h"
 
 class file_source : public audio_source
 {
 public:
-    file_source(discord::voice_context &voice_context, const std::string &file_path);
+    file_source(source_context context, const std::string &file_path);
     virtual ~file_source() = default;
     virtual opus_frame next();
+    virtual bool seek(std::chrono::milliseconds position);
     virtual void prepare();
 
 private:
-    discord::voice_context &voice_context;
-    const std::string &file_path;
+    source_context context;
+    std::string file_path;
+    boost::interprocess::file_mapping mapping;
+    boost::interprocess::mapped_region region;
 
+    // Declared after the mapping, so it stops reading from it before it is unmapped
     float_audio_decoder decoder;
     std::array<uint8_t, 8192> buffer;
+    bool passthrough;
 };
 
 #endif
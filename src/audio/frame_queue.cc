@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <iostream>
+
+#include "audio/frame_queue.h"
+
+// Frames are 20ms, unless the source says otherwise
+static const auto frame_duration = std::chrono::milliseconds{20};
+
+static size_t to_frames(std::chrono::milliseconds duration)
+{
+    return std::max<size_t>(duration / frame_duration, 1);
+}
+
+frame_queue::frame_queue(boost::asio::thread_pool &pool, std::shared_ptr<audio_source> source,
+                         const lookahead_options &options)
+    : strand{boost::asio::make_strand(pool)}
+    , frames{to_frames(options.lookahead)}
+    , source{std::move(source)}
+    , max_frames{to_frames(options.lookahead)}
+    , low_water{std::min(to_frames(options.low_water), max_frames - 1)}
+    , scheduled{false}
+    , stopped{false}
+    , generation{0}
+    , finished{false}
+    , started{false}
+    , starved{false}
+    , lowest{max_frames}
+    , underrun_count{0}
+{
+}
+
+const opus_frame *frame_queue::front()
+{
+    // Drop frames from before a seek
+    auto current = generation.load();
+    while (frames.read_available() > 0 && frames.front().generation != current)
+        frames.pop();
+
+    if (frames.read_available() > 0) {
+        started = true;
+        starved = false;
+        lowest = std::min(lowest, frames.read_available() - 1);
+        return &frames.front().frame;
+    }
+    if (started && !starved) {
+        // Count each time playback runs dry once, not every retry while it stays dry
+        starved = true;
+        underrun_count++;
+        lowest = 0;
+    }
+    return nullptr;
+}
+
+void frame_queue::pop()
+{
+    frames.pop();
+}
+
+void frame_queue::refill()
+{
+    if (frames.read_available() > low_water)
+        return;
+    schedule();
+}
+
+void frame_queue::seek(std::chrono::milliseconds position)
+{
+    // Seek on the strand, so it doesn't race with fill() using the source
+    boost::asio::post(strand, [self = shared_from_this(), position]() {
+        auto lock = std::lock_guard<std::mutex>{self->fill_mutex};
+        if (self->stopped)
+            return;
+
+        if (self->source->seek(position)) {
+            std::cout << "[frame queue] seeked to " << position.count() / 1000 << "s\n";
+            self->generation++;
+            self->finished = false;
+            self->schedule();
+        } else {
+            std::cerr << "[frame queue] could not seek to " << position.count() / 1000 << "s\n";
+        }
+    });
+}
+
+void frame_queue::stop()
+{
+    stopped = true;
+    auto lock = std::lock_guard<std::mutex>{fill_mutex};
+    source.reset();
+}
+
+size_t frame_queue::depth()
+{
+    return frames.read_available();
+}
+
+size_t frame_queue::capacity() const
+{
+    return max_frames;
+}
+
+size_t frame_queue::min_depth() const
+{
+    return lowest;
+}
+
+size_t frame_queue::underruns() const
+{
+    return underrun_count;
+}
+
+void frame_queue::schedule()
+{
+    if (stopped || scheduled.exchange(true))
+        return;
+    boost::asio::post(strand, [self = shared_from_this()]() { self->fill(); });
+}
+
+void frame_queue::fill()
+{
+    auto lock = std::lock_guard<std::mutex>{fill_mutex};
+    scheduled = false;
+
+    // Fill all the way up, so the pool isn't woken up again until the low water mark is reached
+    while (!stopped && !finished && frames.write_available() > 0) {
+        auto frame = source->next();
+        if (frame.empty() && !frame.end_of_source)
+            break;  // Source is waiting on input, try again on the next refill
+
+        finished = frame.end_of_source;
+        frames.push({std::move(frame), generation.load()});
+    }
+}
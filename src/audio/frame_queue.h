@@ -0,0 +1,72 @@
+#ifndef AUDIO_FRAME_QUEUE_H
+#define AUDIO_FRAME_QUEUE_H
+
+#include <atomic>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include "audio/source.h"
+
+struct lookahead_options {
+    std::chrono::milliseconds lookahead{std::chrono::seconds{2}};  // Audio encoded ahead of time
+    std::chrono::milliseconds low_water{std::chrono::seconds{1}};  // Refill below this much audio
+};
+
+// Produces the opus frames of an audio source on a worker pool, ahead of playback. Demuxing,
+// decoding, resampling and encoding all happen on the pool, one fill() at a time per queue, and
+// the guild's strand only pops finished frames off a lock-free single producer/consumer queue
+class frame_queue : public std::enable_shared_from_this<frame_queue>
+{
+public:
+    frame_queue(boost::asio::thread_pool &pool, std::shared_ptr<audio_source> source,
+                const lookahead_options &options);
+
+    // Consumer side, called on the guild's strand. front() returns the next frame to play in place,
+    // or nullptr if there's none yet. It stays valid until pop()
+    const opus_frame *front();
+    void pop();
+    void refill();  // Schedule production of more frames once the queue is below the low water mark
+    void seek(std::chrono::milliseconds position);
+
+    // Stops producing frames, waiting for a fill() in progress to return. The source isn't used
+    // anymore once this returns
+    void stop();
+
+    // Metrics, also consumer side
+    size_t depth();
+    size_t capacity() const;
+    size_t min_depth() const;  // Lowest depth seen while playing
+    size_t underruns() const;  // Times playback found the queue empty
+
+private:
+    struct queued_frame {
+        opus_frame frame;
+        uint32_t generation;  // Frames from before a seek are dropped instead of played
+    };
+
+    boost::asio::strand<boost::asio::thread_pool::executor_type> strand;
+    boost::lockfree::spsc_queue<queued_frame> frames;
+    std::shared_ptr<audio_source> source;
+    size_t max_frames;
+    size_t low_water;
+
+    std::mutex fill_mutex;
+    std::atomic<bool> scheduled;
+    std::atomic<bool> stopped;
+    std::atomic<uint32_t> generation;
+    bool finished;
+
+    bool started;
+    bool starved;
+    size_t lowest;
+    size_t underrun_count;
+
+    void schedule();
+    void fill();
+};
+
+#endif
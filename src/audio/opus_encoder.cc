@@ -22,12 +22,14 @@ discord::opus_encoder::~opus_encoder()
 int32_t discord::opus_encoder::encode(const int16_t *src, int frame_size, unsigned char *dest,
                                       int dest_size)
 {
+    auto lock = std::lock_guard<std::mutex>{mutex};
     return opus_encode(encoder, src, frame_size, dest, dest_size);
 }
 
 int32_t discord::opus_encoder::encode(const float *src, int frame_size, unsigned char *dest,
                                       int dest_size)
 {
+    auto lock = std::lock_guard<std::mutex>{mutex};
     return opus_encode_float(encoder, src, frame_size, dest, dest_size);
 }
 
@@ -37,5 +39,6 @@ void discord::opus_encoder::set_bitrate(int bitrate)
         bitrate = 8000;
     if (bitrate > 128000)
         bitrate = 128000;
+    auto lock = std::lock_guard<std::mutex>{mutex};
     opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
 }
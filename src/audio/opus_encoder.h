@@ -2,6 +2,7 @@
 #define DISCORD_OPUS_ENCODER_H
 
 #include <cstdint>
+#include <mutex>
 
 #include <opus/opus.h>
 
@@ -18,6 +19,8 @@ public:
     void set_bitrate(int bitrate);
 
 private:
+    // Frames are encoded on a worker thread, while the bitrate is changed from an io thread
+    std::mutex mutex;
     OpusEncoder *encoder;
 };
 }  // namespace discord
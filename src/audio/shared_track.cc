@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <limits>
+
+#include "audio/shared_track.h"
+
+shared_track::shared_track(int bitrate)
+    : track{bitrate, {}, {}}
+    , next_start{0}
+    , released{0}
+    , first_start{0}
+    , limit{std::numeric_limits<size_t>::max()}
+    , missing{false}
+    , next_reader{0}
+    , state{track_state::producing}
+{
+}
+
+int shared_track::bitrate() const
+{
+    return track.bitrate;
+}
+
+size_t shared_track::size()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return released + track.frames.size();
+}
+
+size_t shared_track::first()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return released;
+}
+
+size_t shared_track::bytes()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return held_bytes();
+}
+
+bool shared_track::complete()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return state == track_state::complete;
+}
+
+bool shared_track::failed()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return state == track_state::failed;
+}
+
+bool shared_track::partial()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return missing;
+}
+
+int64_t shared_track::samples()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return next_start;
+}
+
+void shared_track::set_limit(size_t bytes)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    limit = bytes;
+}
+
+size_t shared_track::add_reader()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    positions[next_reader] = released;
+    return next_reader++;
+}
+
+void shared_track::remove_reader(size_t reader)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    positions.erase(reader);
+}
+
+size_t shared_track::readers()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return positions.size();
+}
+
+bool shared_track::get(size_t reader, size_t index, opus_frame &frame)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    if (index < released || index >= released + track.frames.size())
+        return false;
+
+    positions[reader] = index;
+    auto encoded = track.frames[index - released];
+    frame.assign(track.payload.data() + encoded.offset, encoded.size);
+    frame.frame_count = encoded.frame_count;
+    frame.end_of_source = false;
+    return true;
+}
+
+bool shared_track::find(int64_t samples, size_t &index)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    if (samples < first_start)
+        return false;
+
+    auto it = std::upper_bound(ends.begin(), ends.end(), samples);
+    if (it == ends.end())
+        return false;
+    index = released + static_cast<size_t>(it - ends.begin());
+    return true;
+}
+
+void shared_track::add(const opus_frame &frame)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    track.add(frame);
+    next_start += frame.frame_count;
+    ends.push_back(next_start);
+    if (held_bytes() > limit)
+        release_passed();
+}
+
+void shared_track::restart(int64_t samples)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    next_start = samples;
+    missing = true;
+}
+
+void shared_track::finish()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    state = track_state::complete;
+}
+
+void shared_track::fail()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    if (state == track_state::producing)
+        state = track_state::failed;
+}
+
+const encoded_track &shared_track::encoded() const
+{
+    return track;
+}
+
+size_t shared_track::held_bytes() const
+{
+    return track.payload.size() + track.frames.size() * (sizeof(encoded_frame) + sizeof(int64_t));
+}
+
+void shared_track::release_passed()
+{
+    if (positions.empty())
+        return;
+    auto first_needed = std::min_element(positions.begin(), positions.end(),
+                                         [](auto &a, auto &b) { return a.second < b.second; });
+    auto count = std::min(first_needed->second - released, track.frames.size());
+
+    // Copying the rest of the track over only pays off once it has halved
+    if (count == 0 || count < track.frames.size() / 2)
+        return;
+
+    auto &frames = track.frames;
+    auto offset = count < frames.size() ? frames[count].offset : track.payload.size();
+    auto payload = std::vector<uint8_t>(track.payload.begin() + offset, track.payload.end());
+    auto kept = std::vector<encoded_frame>(frames.begin() + count, frames.end());
+    for (auto &frame : kept)
+        frame.offset -= offset;
+
+    first_start = ends[count - 1];
+    ends = std::vector<int64_t>(ends.begin() + count, ends.end());
+    track.payload = std::move(payload);
+    track.frames = std::move(kept);
+    released += count;
+    missing = true;
+}
@@ -0,0 +1,69 @@
+#ifndef AUDIO_SHARED_TRACK_H
+#define AUDIO_SHARED_TRACK_H
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "audio/source.h"
+#include "audio/track_cache.h"
+
+// An encoded track that is played while it is still being produced. One track_producer appends
+// frames to it, while any number of shared_track_sources read them, from any thread. A producer
+// that seeks its source leaves a gap in the track, frames after it start at the seek's position.
+// Once the track holds more than its limit, frames every reader has passed are released
+class shared_track
+{
+public:
+    explicit shared_track(int bitrate);
+    int bitrate() const;
+    size_t size();   // Frames produced so far
+    size_t first();  // Frames before this one were released
+    size_t bytes();  // Memory held by the frames
+    bool complete();
+    bool failed();
+    bool partial();     // Frames were seeked past or released, it can't be shared or cached
+    int64_t samples();  // Position the next produced frame starts at
+    void set_limit(size_t bytes);
+
+    // Guilds playing the track, each reader is an id for its position
+    size_t add_reader();
+    void remove_reader(size_t reader);
+    size_t readers();
+
+    // Copies frame index into frame and moves reader there, returns false if it hasn't been
+    // produced yet or was released
+    bool get(size_t reader, size_t index, opus_frame &frame);
+
+    // Finds the frame playing at samples into the track, returns false if it hasn't been
+    // produced yet or was released
+    bool find(int64_t samples, size_t &index);
+
+    // Producer side
+    void add(const opus_frame &frame);
+    void restart(int64_t samples);  // The source was seeked, the next frame starts at samples
+    void finish();
+    void fail();
+
+    // The whole track, only once it is complete() and not partial()
+    const encoded_track &encoded() const;
+
+private:
+    std::mutex mutex;
+    encoded_track track;
+    std::vector<int64_t> ends;  // Sample each frame ends at, searched by find()
+    int64_t next_start;
+    size_t released;      // Frames dropped from the front of track
+    int64_t first_start;  // Sample the first frame still held starts at
+    size_t limit;
+    bool missing;
+    std::unordered_map<size_t, size_t> positions;  // Next frame of each reader
+    size_t next_reader;
+    enum class track_state { producing, complete, failed } state;
+
+    size_t held_bytes() const;
+    void release_passed();
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include <iostream>
+
+#include "audio/shared_track_source.h"
+
+shared_track_source::shared_track_source(std::shared_ptr<shared_track> track,
+                                         std::shared_ptr<track_producer> producer,
+                                         error_cb on_ready)
+    : track{std::move(track)}
+    , producer{std::move(producer)}
+    , on_ready{std::move(on_ready)}
+    , reader{this->track->add_reader()}
+    , next_frame{0}
+    , seek_samples{-1}
+{
+}
+
+shared_track_source::~shared_track_source()
+{
+    track->remove_reader(reader);
+}
+
+opus_frame shared_track_source::next()
+{
+    if (producer) {
+        auto wanted = seek_samples < 0 ? next_frame : track->size();
+        producer->request(wanted + produce_ahead);
+    }
+
+    // Wait for the producer to get to the position of the seek
+    if (seek_samples >= 0) {
+        if (track->find(seek_samples, next_frame))
+            seek_samples = -1;
+        else if (track->complete() || track->failed())
+            return opus_frame::source_end();
+        else
+            return {};
+    }
+
+    auto frame = opus_frame{};
+    if (track->get(reader, next_frame, frame)) {
+        next_frame++;
+        frame.end_of_source = track->complete() && next_frame == track->size();
+        return frame;
+    }
+    if (next_frame < track->first()) {
+        // Released before this reader got to start, over the memory budget
+        std::cerr << "[shared track source] track was released\n";
+        return opus_frame::source_end();
+    }
+    if (track->failed()) {
+        std::cerr << "[shared track source] track could not be produced\n";
+        return opus_frame::source_end();
+    }
+    if (track->complete())
+        return opus_frame::source_end();
+    return {};  // Not produced yet
+}
+
+bool shared_track_source::seek(std::chrono::milliseconds position)
+{
+    auto target = position.count() * 48;
+    if (track->find(target, next_frame)) {
+        seek_samples = -1;
+        return true;
+    }
+    if (track->complete() || track->failed() || target < track->samples())
+        return false;  // Released, or past the end
+
+    // Not produced yet, next() waits for it. Unless other guilds are playing the track too, a
+    // long way ahead is quicker reached by seeking the producer's source
+    if (producer && target - track->samples() > max_seek_wait && track->readers() == 1)
+        producer->seek(position);
+    seek_samples = target;
+    return true;
+}
+
+void shared_track_source::prepare()
+{
+    // Frames can be read right away, even if the producer hasn't got to them yet
+    auto error = boost::system::error_code{};
+    if (track->failed())
+        error = make_error_code(boost::system::errc::io_error);
+    on_ready(error);
+}
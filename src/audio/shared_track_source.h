@@ -0,0 +1,40 @@
+#ifndef AUDIO_SHARED_TRACK_SOURCE_H
+#define AUDIO_SHARED_TRACK_SOURCE_H
+
+#include <memory>
+
+#include "audio/shared_track.h"
+#include "audio/source.h"
+#include "audio/track_producer.h"
+#include "callbacks.h"
+
+// Plays a shared_track, possibly while it is still being produced. Each guild playing the track
+// has its own shared_track_source, with its own position in the track
+class shared_track_source : public audio_source
+{
+public:
+    // The producer is null once the track is complete
+    shared_track_source(std::shared_ptr<shared_track> track,
+                        std::shared_ptr<track_producer> producer, error_cb on_ready);
+    virtual ~shared_track_source();
+    virtual opus_frame next();
+    virtual bool seek(std::chrono::milliseconds position);
+    virtual void prepare();
+
+private:
+    // Frames produced ahead of this reader's position, 10 seconds
+    static constexpr size_t produce_ahead = 500;
+
+    // Seeks further than this past what has been produced restart the producer at the position,
+    // shorter ones wait for it to get there
+    static constexpr int64_t max_seek_wait = 10 * 48000;
+
+    std::shared_ptr<shared_track> track;
+    std::shared_ptr<track_producer> producer;
+    error_cb on_ready;
+    size_t reader;
+    size_t next_frame;
+    int64_t seek_samples;  // Position of a seek past what has been produced, -1 if none
+};
+
+#endif
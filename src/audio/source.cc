@@ -1,10 +1,50 @@
-#include <array>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 
 #include "audio/source.h"
 
+opus_frame::opus_frame() : size{0}, frame_count{0}, end_of_source{false}
+{
+}
+
+opus_frame::opus_frame(const opus_frame &other)
+    : size{other.size}, frame_count{other.frame_count}, end_of_source{other.end_of_source}
+{
+    std::memcpy(data.data(), other.data.data(), size);
+}
+
+opus_frame &opus_frame::operator=(const opus_frame &other)
+{
+    size = other.size;
+    frame_count = other.frame_count;
+    end_of_source = other.end_of_source;
+    std::memcpy(data.data(), other.data.data(), size);
+    return *this;
+}
+
+opus_frame opus_frame::source_end()
+{
+    auto frame = opus_frame{};
+    frame.end_of_source = true;
+    return frame;
+}
+
+bool opus_frame::empty() const
+{
+    return size == 0;
+}
+
+bool opus_frame::assign(const uint8_t *bytes, size_t count)
+{
+    if (count > max_size)
+        return false;
+    std::memcpy(data.data(), bytes, count);
+    size = count;
+    return true;
+}
+
 opus_frame next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
                       size_t buf_size)
 {
@@ -30,13 +70,28 @@ opus_frame next_frame(float_audio_decoder &decoder, discord::opus_encoder &encod
         std::fill(start, end, 0.0f);
     }
     if (read > 0) {
-        auto buf = std::array<uint8_t, 512>{};
-        auto encoded_len = encoder.encode(float_buf, frames_wanted, buf.data(), static_cast<int>(buf.size()));
-        if (encoded_len > 0) {
-            frame.data.reserve(encoded_len);
-            frame.data.insert(std::begin(frame.data), buf.data(), buf.data() + encoded_len);
-        }
+        // Encoded straight into the frame
+        auto encoded_len = encoder.encode(float_buf, frames_wanted, frame.data.data(),
+                                          static_cast<int>(frame.data.size()));
+        if (encoded_len > 0)
+            frame.size = static_cast<size_t>(encoded_len);
     }
     frame.frame_count = frames_wanted;
     return frame;
 }
+
+opus_frame next_packet(float_audio_decoder &decoder)
+{
+    auto frame = opus_frame{};
+    auto packet = decoder.read_packet();
+
+    // A packet holding several large frames won't fit, it's skipped. The bit rate limit on
+    // passthrough keeps these rare
+    while (packet.size > 0 && !frame.assign(packet.data, static_cast<size_t>(packet.size))) {
+        std::cerr << "[audio] skipping " << packet.size << " byte opus packet\n";
+        packet = decoder.read_packet();
+    }
+    frame.frame_count = packet.frame_count;
+    frame.end_of_source = packet.size == 0 && decoder.done();
+    return frame;
+}
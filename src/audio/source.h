@@ -1,14 +1,31 @@
 #ifndef AUDIO_SOURCE_H
 #define AUDIO_SOURCE_H
 
+#include <array>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
 #include <cstdint>
-#include <vector>
 
 #include "audio/decoding.h"
 #include "audio/opus_encoder.h"
+#include "callbacks.h"
 
+// An encoded opus packet, stored inline so frames are produced, queued and sent without touching
+// the heap. Copies only copy the bytes in use
 struct opus_frame {
-    std::vector<uint8_t> data;
+    static constexpr size_t max_size = 1275;  // Largest packet of a single opus frame, RFC 6716
+
+    opus_frame();
+    opus_frame(const opus_frame &other);
+    opus_frame &operator=(const opus_frame &other);
+
+    static opus_frame source_end();  // No data, end_of_source set
+
+    bool empty() const;
+    bool assign(const uint8_t *bytes, size_t count);  // False if count is above max_size
+
+    std::array<uint8_t, max_size> data;
+    size_t size;
     int frame_count;
     bool end_of_source;
 };
@@ -16,10 +33,26 @@ struct opus_frame {
 opus_frame next_frame(float_audio_decoder &decoder, discord::opus_encoder &encoder, uint8_t *buffer,
                       size_t buf_size);
 
+// Passthrough alternative to next_frame(), for decoders that can_passthrough(): the stream's opus
+// packets are sent as they are, without decoding and encoding them again
+opus_frame next_packet(float_audio_decoder &decoder);
+
+// What a live source needs from whoever produces its frames. A track is produced once, by a
+// track_producer, however many guilds are playing it
+struct source_context {
+    boost::asio::io_context &ctx;
+    discord::opus_encoder &encoder;
+    int bitrate;        // The encoder's bitrate
+    error_cb on_ready;  // Called from an io thread once the source can produce frames
+};
+
 struct audio_source {
     virtual ~audio_source() = default;
     virtual opus_frame next() = 0;
 
+    // Moves playback to position in the track, returns false if the source can't get there
+    virtual bool seek(std::chrono::milliseconds position) = 0;
+
     // The audio source might need some preparation that can't be done in the constructor.
     // E.g. youtube_dl_source needs to create a child process and begin reading from async_pipe,
     // but it cannot retrieve a weak_ptr to itself until after the constructor has finished.
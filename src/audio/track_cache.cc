@@ -0,0 +1,151 @@
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+#include "audio/track_cache.h"
+
+static const char track_magic[8] = {'D', 'M', 'B', 'O', 'P', 'U', 'S', '\0'};
+static const auto track_version = uint32_t{1};
+
+void encoded_track::add(const opus_frame &frame)
+{
+    auto offset = static_cast<uint32_t>(payload.size());
+    payload.insert(payload.end(), frame.data.begin(), frame.data.begin() + frame.size);
+    frames.push_back({offset, static_cast<uint16_t>(frame.size),
+                      static_cast<uint16_t>(frame.frame_count)});
+}
+
+track_cache::track_cache(std::string directory) : directory{std::move(directory)}
+{
+    if (!enabled())
+        return;
+
+    auto ec = boost::system::error_code{};
+    boost::filesystem::create_directories(this->directory, ec);
+    if (ec)
+        std::cerr << "[track cache] could not create " << this->directory << ": " << ec.message()
+                  << "\n";
+}
+
+bool track_cache::enabled() const
+{
+    return !directory.empty();
+}
+
+std::string track_cache::lookup(const std::string &url, int bitrate) const
+{
+    if (!enabled())
+        return {};
+
+    // Channels with other bitrates encode the track again, and keep their own copy of it
+    auto file_path = path(url, bitrate);
+    auto ec = boost::system::error_code{};
+    if (!boost::filesystem::exists(file_path, ec))
+        return {};
+
+    // A damaged track is a miss, it is stored again once it has been encoded
+    if (!check_file(file_path, bitrate)) {
+        std::cerr << "[track cache] " << file_path << " is damaged, removing it\n";
+        boost::filesystem::remove(file_path, ec);
+        return {};
+    }
+    return file_path;
+}
+
+void track_cache::store(const std::string &url, const encoded_track &track) const
+{
+    if (!enabled() || track.frames.empty())
+        return;
+
+    namespace fs = boost::filesystem;
+    auto file_path = path(url, track.bitrate);
+    auto temp_path = file_path + fs::unique_path(".%%%%-%%%%.tmp").string();
+
+    auto header = track_file_header{};
+    std::memcpy(header.magic, track_magic, sizeof(track_magic));
+    header.version = track_version;
+    header.bitrate = static_cast<uint32_t>(track.bitrate);
+    header.frame_count = static_cast<uint32_t>(track.frames.size());
+    header.payload_size = static_cast<uint32_t>(track.payload.size());
+
+    {
+        auto file = std::ofstream{temp_path, std::ios::binary | std::ios::trunc};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(track.frames.data()),
+                   track.frames.size() * sizeof(encoded_frame));
+        file.write(reinterpret_cast<const char *>(track.payload.data()), track.payload.size());
+        if (!file) {
+            std::cerr << "[track cache] could not write " << temp_path << "\n";
+            auto ec = boost::system::error_code{};
+            fs::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    auto ec = boost::system::error_code{};
+    fs::rename(temp_path, file_path, ec);
+    if (ec) {
+        std::cerr << "[track cache] could not store " << file_path << ": " << ec.message() << "\n";
+        fs::remove(temp_path, ec);
+        return;
+    }
+    std::cout << "[track cache] stored " << key(url) << " at " << track.bitrate / 1000 << "Kbps ("
+              << track.frames.size() << " frames)\n";
+}
+
+std::string track_cache::key(const std::string &url)
+{
+    static const auto youtube_re =
+        std::regex{R"((?:youtube\.com/watch\?(?:\S*&)?v=|youtu\.be/)([A-Za-z0-9_-]{11}))"};
+    auto matcher = std::smatch{};
+    if (std::regex_search(url, matcher, youtube_re))
+        return "youtube-" + matcher.str(1);
+
+    // 64 bit FNV-1a
+    auto hash = uint64_t{14695981039346656037ULL};
+    for (auto c : url) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    auto key = std::ostringstream{};
+    key << "url-" << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return key.str();
+}
+
+bool track_cache::check_header(const track_file_header &header)
+{
+    return std::memcmp(header.magic, track_magic, sizeof(track_magic)) == 0 &&
+           header.version == track_version;
+}
+
+bool track_cache::check_frame(const track_file_header &header, const encoded_frame &frame)
+{
+    return frame.size <= opus_frame::max_size &&
+           uint64_t{frame.offset} + frame.size <= header.payload_size;
+}
+
+bool track_cache::check_file(const std::string &file_path, int bitrate) const
+{
+    auto file = std::ifstream{file_path, std::ios::binary};
+    auto header = track_file_header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || !check_header(header) ||
+        header.bitrate != static_cast<uint32_t>(bitrate))
+        return false;
+
+    // The index and payload the header describes must all be there. Only the header is read,
+    // this runs on the guild's strand. cached_source checks each frame as it plays it
+    auto ec = boost::system::error_code{};
+    auto size = boost::filesystem::file_size(file_path, ec);
+    auto index_size = uint64_t{header.frame_count} * sizeof(encoded_frame);
+    return !ec && size >= sizeof(header) + index_size + header.payload_size;
+}
+
+std::string track_cache::path(const std::string &url, int bitrate) const
+{
+    auto name = key(url) + "-" + std::to_string(bitrate) + ".opus-frames";
+    return (boost::filesystem::path{directory} / name).string();
+}
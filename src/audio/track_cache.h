@@ -0,0 +1,66 @@
+#ifndef AUDIO_TRACK_CACHE_H
+#define AUDIO_TRACK_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "audio/source.h"
+
+// Where a frame is in an encoded_track's payload
+struct encoded_frame {
+    uint32_t offset;
+    uint16_t size;
+    uint16_t frame_count;
+};
+
+// The opus frames of a whole track, back to back
+struct encoded_track {
+    int bitrate;
+    std::vector<uint8_t> payload;
+    std::vector<encoded_frame> frames;
+
+    void add(const opus_frame &frame);
+};
+
+// A cached track is a track_file_header, followed by its encoded_frame index and then its
+// payload, in native byte order. Everything is aligned so the file can be used straight from a
+// memory mapping
+struct track_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bitrate;
+    uint32_t frame_count;
+    uint32_t payload_size;
+};
+
+// Directory of encoded tracks, keyed by their normalized url and the bitrate they were encoded at.
+// Tracks are written to a temporary file that is renamed into place, so readers never see a
+// partial track
+class track_cache
+{
+public:
+    explicit track_cache(std::string directory);  // An empty directory disables the cache
+    bool enabled() const;
+
+    // Path of url's cached track if it was encoded at bitrate, empty otherwise
+    std::string lookup(const std::string &url, int bitrate) const;
+    void store(const std::string &url, const encoded_track &track) const;
+
+    // YouTube links are keyed by video id, anything else by a hash of the url
+    static std::string key(const std::string &url);
+
+    // True if header starts a cached track in the current format
+    static bool check_header(const track_file_header &header);
+
+    // True if frame lies within the payload header describes, and fits in an opus_frame
+    static bool check_frame(const track_file_header &header, const encoded_frame &frame);
+
+private:
+    std::string directory;
+
+    std::string path(const std::string &url, int bitrate) const;
+    bool check_file(const std::string &file_path, int bitrate) const;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <iostream>
+
+#include "audio/track_lru.h"
+
+track_lru::track_lru(size_t budget) : budget{budget}, hits{0}, misses{0}, evictions{0} {}
+
+// Guilds at different bitrates can't share an encode
+static std::string bitrate_key(const std::string &key, int bitrate)
+{
+    return key + "@" + std::to_string(bitrate);
+}
+
+track_lru::entry track_lru::find(const std::string &key, int bitrate)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto it = tracks.find(bitrate_key(key, bitrate));
+    if (it == tracks.end()) {
+        misses++;
+        return {};
+    }
+
+    // A track that stopped being produced before it was complete can't be played, one that was
+    // seeked or released frames can't be played from the start
+    auto &cached = it->second;
+    auto producer = cached.producer.lock();
+    if (cached.track->failed() || cached.track->partial() ||
+        (!producer && !cached.track->complete())) {
+        erase(it);
+        misses++;
+        return {};
+    }
+
+    order.splice(order.begin(), order, cached.position);
+    hits++;
+    auto found = entry{cached.track, producer};
+    evict();
+    return found;
+}
+
+void track_lru::insert(const std::string &key, const entry &e)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto full_key = bitrate_key(key, e.track->bitrate());
+    auto it = tracks.find(full_key);
+    if (it != tracks.end())
+        erase(it);
+
+    order.push_front(full_key);
+    tracks[full_key] = {e.track, e.producer, order.begin()};
+    evict();
+}
+
+track_lru_stats track_lru::stats()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto bytes = size_t{0};
+    for (auto &it : tracks)
+        bytes += it.second.track->bytes();
+    return {hits, misses, evictions, tracks.size(), bytes};
+}
+
+void track_lru::erase(std::unordered_map<std::string, cached_track>::iterator it)
+{
+    order.erase(it->second.position);
+    tracks.erase(it);
+}
+
+void track_lru::evict()
+{
+    // Tracks still being produced are kept room to grow to a size that can still be cached
+    auto producing = size_t{0};
+    auto complete_bytes = size_t{0};
+    for (auto &it : tracks) {
+        auto &track = it.second.track;
+        if (!track->complete() && !track->failed())
+            producing++;
+        else
+            complete_bytes += track->bytes();
+    }
+    auto reserve = producing ? std::min(track_producer::max_cached_bytes, budget / producing) : 0;
+    auto bytes = complete_bytes;
+    for (auto &it : tracks) {
+        auto &track = it.second.track;
+        if (!track->complete() && !track->failed())
+            bytes += std::max(reserve, track->bytes());
+    }
+
+    // Walk from the least recently used track, skipping the ones still being produced
+    auto key = order.end();
+    while (bytes > budget && key != order.begin()) {
+        --key;
+        auto it = tracks.find(*key);
+        auto &track = it->second.track;
+        if (!track->complete() && !track->failed())
+            continue;
+
+        auto track_bytes = track->bytes();
+        std::cout << "[track lru] evicted " << *key << " (" << track_bytes / 1024 << "KB)\n";
+        bytes -= track_bytes;
+        complete_bytes -= track_bytes;
+        evictions++;
+        key = order.erase(key);
+        tracks.erase(it);
+    }
+    if (producing == 0)
+        return;
+
+    // They split what is left, past their share they release the frames their readers have passed
+    auto share = (budget - std::min(budget, complete_bytes)) / producing;
+    for (auto &it : tracks) {
+        auto &track = it.second.track;
+        if (!track->complete() && !track->failed())
+            track->set_limit(share);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef AUDIO_TRACK_LRU_H
+#define AUDIO_TRACK_LRU_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "audio/shared_track.h"
+#include "audio/track_producer.h"
+
+struct track_lru_stats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t tracks;
+    size_t bytes;
+};
+
+// Recently played shared_tracks, kept in memory so guilds playing the same track share one
+// encode. Complete tracks are evicted, least recently used first, once they take up more than
+// the budget. Tracks still being produced are shared as long as somebody is playing them, and
+// split what the complete ones leave of the budget between them
+class track_lru
+{
+public:
+    explicit track_lru(size_t budget);
+
+    struct entry {
+        std::shared_ptr<shared_track> track;        // Null on a miss
+        std::shared_ptr<track_producer> producer;  // Null once the track is complete
+    };
+
+    // The track stored under key for bitrate, a track is stored once for each bitrate it was
+    // encoded at
+    entry find(const std::string &key, int bitrate);
+    void insert(const std::string &key, const entry &e);
+    track_lru_stats stats();
+
+private:
+    struct cached_track {
+        std::shared_ptr<shared_track> track;
+        std::weak_ptr<track_producer> producer;
+        std::list<std::string>::iterator position;
+    };
+
+    std::mutex mutex;
+    size_t budget;
+    std::list<std::string> order;  // Most recently used first
+    std::unordered_map<std::string, cached_track> tracks;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+
+    void erase(std::unordered_map<std::string, cached_track>::iterator it);
+    void evict();
+};
+
+#endif
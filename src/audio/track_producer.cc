@@ -0,0 +1,127 @@
+#include <boost/asio/post.hpp>
+#include <iostream>
+
+#include "audio/track_producer.h"
+
+track_producer::track_producer(boost::asio::io_context &ctx, boost::asio::thread_pool &pool,
+                               const track_cache &cache, const std::string &url, int bitrate)
+    : ctx{ctx}
+    , strand{boost::asio::make_strand(pool)}
+    , cache{cache}
+    , url{url}
+    , encoder{2, 48000}
+    , track{std::make_shared<shared_track>(bitrate)}
+    , wanted{0}
+    , seek_to{-1}
+    , scheduled{false}
+    , ready{false}
+    , finished{false}
+{
+    encoder.set_bitrate(bitrate);
+}
+
+track_producer::~track_producer()
+{
+    // Nobody is playing the track anymore, it can't be shared until it's produced again
+    track->fail();
+
+    // The last reference may be dropped on the worker pool, but the source's pipe belongs to the
+    // io_context
+    boost::asio::post(ctx, [source = std::move(source)]() {});
+}
+
+source_context track_producer::context()
+{
+    auto on_ready = [weak = weak_from_this()](const auto &ec) {
+        if (auto self = weak.lock())
+            self->on_source_ready(ec);
+    };
+    return {ctx, encoder, track->bitrate(), on_ready};
+}
+
+void track_producer::start(std::shared_ptr<audio_source> source)
+{
+    this->source = std::move(source);
+    this->source->prepare();
+}
+
+std::shared_ptr<shared_track> track_producer::get_track() const
+{
+    return track;
+}
+
+void track_producer::request(size_t frames)
+{
+    auto current = wanted.load();
+    while (current < frames && !wanted.compare_exchange_weak(current, frames)) {
+    }
+    if (track->size() < frames)
+        schedule();
+}
+
+void track_producer::seek(std::chrono::milliseconds position)
+{
+    // Applied by the next fill(), once the source is ready
+    seek_to = position.count();
+    schedule();
+}
+
+void track_producer::on_source_ready(const boost::system::error_code &ec)
+{
+    if (ec) {
+        std::cerr << "[track producer] error making audio source: " << ec.message() << "\n";
+        track->fail();
+        return;
+    }
+    ready = true;
+    schedule();
+}
+
+void track_producer::schedule()
+{
+    if (!ready || scheduled.exchange(true))
+        return;
+    boost::asio::post(strand, [self = shared_from_this()]() { self->fill(); });
+}
+
+void track_producer::fill()
+{
+    scheduled = false;
+
+    auto position = std::chrono::milliseconds{seek_to.exchange(-1)};
+    if (!finished && position.count() >= 0 && position.count() * 48 > track->samples()) {
+        if (source->seek(position)) {
+            std::cout << "[track producer] seeked to " << position.count() / 1000 << "s\n";
+            track->restart(position.count() * 48);
+        } else {
+            std::cerr << "[track producer] could not seek to " << position.count() / 1000
+                      << "s\n";
+        }
+    }
+
+    while (!finished && track->size() < wanted) {
+        auto frame = source->next();
+        if (frame.empty() && !frame.end_of_source)
+            break;  // Source is waiting on input, the next request() tries again
+
+        if (!frame.empty())
+            track->add(frame);
+        if (frame.end_of_source) {
+            finished = true;
+            track->finish();
+            store();
+        }
+    }
+}
+
+void track_producer::store()
+{
+    // Part of a seeked track is missing, as is the start of one that ran over the memory budget
+    if (track->partial())
+        return;
+    if (track->bytes() > max_cached_bytes) {
+        std::cout << "[track producer] not caching " << url << ", it is too big\n";
+        return;
+    }
+    cache.store(url, track->encoded());
+}
@@ -0,0 +1,61 @@
+#ifndef AUDIO_TRACK_PRODUCER_H
+#define AUDIO_TRACK_PRODUCER_H
+
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "audio/opus_encoder.h"
+#include "audio/shared_track.h"
+#include "audio/source.h"
+#include "audio/track_cache.h"
+
+// Encodes a live source into a shared_track on the worker pool, once for every guild playing it.
+// Production follows the furthest reader, the readers request() the frames they will need next.
+// A complete track is stored in the track_cache unless it was seeked or is too big, an incomplete
+// one fails when the last reader lets go of the producer. A reader seeking far past what has been
+// produced seeks the live source instead of waiting for the producer to encode its way there
+class track_producer : public std::enable_shared_from_this<track_producer>
+{
+public:
+    // Tracks longer than this (about an hour and a half at 96Kbps) aren't cached on disk
+    static constexpr size_t max_cached_bytes = 64 * 1024 * 1024;
+
+    track_producer(boost::asio::io_context &ctx, boost::asio::thread_pool &pool,
+                   const track_cache &cache, const std::string &url, int bitrate);
+    ~track_producer();
+
+    // For constructing the live source, which is then handed to start()
+    source_context context();
+    void start(std::shared_ptr<audio_source> source);
+
+    std::shared_ptr<shared_track> get_track() const;
+    void request(size_t frames);  // Produce at least this many frames, if the track is that long
+    void seek(std::chrono::milliseconds position);  // Carry on producing from position
+
+private:
+    boost::asio::io_context &ctx;
+    boost::asio::strand<boost::asio::thread_pool::executor_type> strand;
+    const track_cache &cache;
+    std::string url;
+    discord::opus_encoder encoder;
+    std::shared_ptr<shared_track> track;
+    std::shared_ptr<audio_source> source;
+
+    std::atomic<size_t> wanted;
+    std::atomic<int64_t> seek_to;  // Milliseconds, -1 if no seek is pending
+    std::atomic<bool> scheduled;
+    std::atomic<bool> ready;
+    bool finished;  // Only used on the strand
+
+    void on_source_ready(const boost::system::error_code &ec);
+    void schedule();
+    void fill();
+    void store();
+};
+
+#endif
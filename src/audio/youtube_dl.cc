@@ -1,5 +1,4 @@
 #include <boost/asio/post.hpp>
-#include <boost/asio/read.hpp>
 #include <boost/process/io.hpp>
 #include <iostream>
 
@@ -7,14 +6,36 @@
 
 static const auto channels = 2;
 
-youtube_dl_source::youtube_dl_source(discord::voice_context &voice_context, const std::string &url)
-    : voice_context{voice_context}, pipe{voice_context.get_io_context()}, url{url}
+// Pipe reads go straight into the decoder's input buffer, in chunks of at most max_pipe_read.
+// Once the buffer is full, reading resumes when at least min_pipe_read bytes are free
+static const auto max_pipe_read = size_t{64 * 1024};
+static const auto min_pipe_read = size_t{8192};
+
+youtube_dl_source::youtube_dl_source(source_context context, const std::string &url)
+    : context{std::move(context)}, pipe{this->context.ctx}, url{url}
 {
 }
 
 opus_frame youtube_dl_source::next()
 {
-    return next_frame(decoder, voice_context.get_encoder(), buffer.data(), buffer.size());
+    auto frame = passthrough ? next_packet(decoder)
+                             : next_frame(decoder, context.encoder, buffer.data(),
+                                          buffer.size());
+
+    // Decoding made room in the decoder's input buffer, resume reading if we were waiting on it.
+    // The pipe belongs to the io_context, so reading is resumed over there
+    if (pipe_paused && decoder.space() >= min_pipe_read && pipe_paused.exchange(false)) {
+        boost::asio::post(context.ctx, [weak = weak_from_this()]() {
+            if (auto self = weak.lock())
+                self->read_from_pipe({}, 0);
+        });
+    }
+    return frame;
+}
+
+bool youtube_dl_source::seek(std::chrono::milliseconds position)
+{
+    return decoder.seek(position);
 }
 
 void youtube_dl_source::prepare()
@@ -26,10 +47,17 @@ void youtube_dl_source::make_process(const std::string &url)
 {
     namespace bp = boost::process;
     // Formats at https://github.com/rg3/youtube-dl/blob/master/youtube_dl/extractor/youtube.py
-    // Prefer opus, vorbis, aac
-    child = bp::child{"youtube-dl -f 250/251/249/171/172 -o - " + url,
+    // Prefer opus, vorbis, aac. The opus formats are roughly 50 (249), 70 (250) and 160 (251)
+    // Kbps, the first one that fits the channel can be passed through without transcoding
+    auto bitrate = context.bitrate;
+    auto formats = bitrate >= 128000 ? "251/250/249/171/172"
+                                     : bitrate >= 70000 ? "250/251/249/171/172"
+                                                        : "249/250/251/171/172";
+    child = bp::child{"youtube-dl -f " + std::string{formats} + " -o - " + url,
                       bp::std_in<bp::null, bp::std_err> bp::null, bp::std_out > pipe};
     notified = false;
+    passthrough = false;
+    pipe_paused = false;
     bytes_sent_to_decoder = 0;
 
     std::cout << "[youtube-dl source] created process for " << url << "\n";
@@ -39,17 +67,32 @@ void youtube_dl_source::make_process(const std::string &url)
 void youtube_dl_source::read_from_pipe(const boost::system::error_code &e, size_t transferred)
 {
     if (transferred > 0) {
-        // Commit any transferred data to the audio_file_data vector
-        decoder.feed(buffer.data(), transferred);
+        // The pipe was read straight into the decoder's input buffer, make it visible
+        decoder.commit(transferred);
         bytes_sent_to_decoder += transferred;
+
+        // Start playing as soon as the container can be probed, the rest of the stream is
+        // decoded while it is still downloading
+        if (!notified)
+            check_decoder();
     }
     if (!e) {
+        if (decoder.space() == 0) {
+            // The decoder's input is full, next() resumes reading once playback has consumed some
+            pipe_paused = true;
+            return;
+        }
         auto pipe_read_cb = [weak = weak_from_this()](const auto &ec, size_t transferred) {
             if (auto self = weak.lock())
                 self->read_from_pipe(ec, transferred);
         };
-        // Read from the pipe and fill up the audio_file_data vector
-        boost::asio::async_read(pipe, boost::asio::buffer(buffer), pipe_read_cb);
+        // Read from the pipe into the free space of the decoder's input buffer. Whatever has
+        // arrived is committed right away, a throttled download trickles in far below a full read
+        auto regions = decoder.prepare(max_pipe_read);
+        auto buffers = std::array<boost::asio::mutable_buffer, 2>{
+            boost::asio::buffer(regions[0].data, regions[0].size),
+            boost::asio::buffer(regions[1].data, regions[1].size)};
+        pipe.async_read_some(buffers, pipe_read_cb);
     } else if (e == boost::asio::error::eof || (bytes_sent_to_decoder > 0)) {
         std::cout << "[youtube-dl source] got eof from async_pipe\n";
 
@@ -64,18 +107,40 @@ void youtube_dl_source::read_from_pipe(const boost::system::error_code &e, size_
             std::cerr << "[youtube-dl source] error closing pipe: " << be.message() << "\n";
         if (se)
             std::cerr << "[youtube-dl source] error waiting for process: " << se.message() << "\n";
+
+        decoder.close_input();
         if (!notified) {
-            decoder.check_stream();
-            notified = true;
-            auto error = decoder.ready() ? boost::system::error_code{}
-                                         : make_error_code(boost::system::errc::io_error);
-            voice_context.notify_audio_source_ready(error);
+            check_decoder();
+            if (!notified) {
+                notified = true;
+                auto error = make_error_code(boost::system::errc::io_error);
+                context.on_ready(error);
+            }
         }
     } else {
         std::cerr << "[youtube-dl source] pipe read error: " << e.message() << "\n";
         if (!notified) {
-            voice_context.notify_audio_source_ready(e);
+            context.on_ready(e);
             notified = true;
         }
     }
 }
+
+void youtube_dl_source::check_decoder()
+{
+    decoder.check_stream();
+
+    // Nothing more is read into a full input buffer until playback starts consuming it, so
+    // probing has to make do with what's there
+    while (!decoder.ready() && !decoder.failed() && decoder.space() == 0)
+        decoder.check_stream();
+    if (decoder.ready() || decoder.failed()) {
+        notified = true;
+        passthrough = decoder.can_passthrough(context.bitrate);
+        if (passthrough)
+            std::cout << "[youtube-dl source] passing opus through without transcoding\n";
+        auto error = decoder.ready() ? boost::system::error_code{}
+                                     : make_error_code(boost::system::errc::io_error);
+        context.on_ready(error);
+    }
+}
@@ -2,6 +2,7 @@
 #define AUDIO_SOURCE_YOUTUBE_DL_H
 
 #include <array>
+#include <atomic>
 #include <boost/asio/io_context.hpp>
 #include <boost/process/async_pipe.hpp>
 #include <boost/process/child.hpp>
@@ -10,20 +11,19 @@
 #include "audio/decoding.h"
 #include "audio/opus_encoder.h"
 #include "audio/source.h"
-#include "callbacks.h"
-#include "voice/voice_connector.h"
 
 class youtube_dl_source : public audio_source,
                           public std::enable_shared_from_this<youtube_dl_source>
 {
 public:
-    youtube_dl_source(discord::voice_context &voice_context, const std::string &url);
+    youtube_dl_source(source_context context, const std::string &url);
     virtual ~youtube_dl_source() = default;
     virtual opus_frame next();
+    virtual bool seek(std::chrono::milliseconds position);
     virtual void prepare();
 
 private:
-    discord::voice_context &voice_context;
+    source_context context;
     boost::process::child child;
     boost::process::async_pipe pipe;
 
@@ -31,11 +31,14 @@ private:
     std::array<uint8_t, 8192> buffer;
     int bytes_sent_to_decoder;
 
-    const std::string &url;
+    std::string url;
     bool notified;
+    bool passthrough;  // Decided once the stream is probed, before next() is first called
+    std::atomic<bool> pipe_paused;  // next() runs on the worker pool
 
     void make_process(const std::string &url);
     void read_from_pipe(const boost::system::error_code &e, size_t transferred);
+    void check_decoder();
 };
 
 #endif
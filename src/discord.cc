@@ -1,10 +1,31 @@
+#include <stdexcept>
+#include <vector>
+
 #include "discord.h"
+#include "etf.h"
 
 static discord::snowflake make_snowflake(const std::string &s)
 {
     return static_cast<discord::snowflake>(std::stoull(s, nullptr, 10));
 }
 
+// Snowflakes are strings in json but integers in etf
+static discord::snowflake make_snowflake(const nlohmann::json &json)
+{
+    if (json.is_number_unsigned())
+        return json.get<discord::snowflake>();
+    return make_snowflake(json.get<std::string>());
+}
+
+static discord::snowflake get_snowflake_safe(const nlohmann::json &json, const std::string &field)
+{
+    auto find = json.find(field);
+    if (find != json.end() && (find.value().is_string() || find.value().is_number_unsigned()))
+        return make_snowflake(find.value());
+    else
+        return 0;
+}
+
 template<typename T>
 T get_safe(const nlohmann::json &json, const std::string &field, T default_val)
 {
@@ -27,7 +48,6 @@ std::string get_safe<std::string>(const nlohmann::json &json, const std::string
 }
 
 static std::string empty_string = "";
-static std::string zero_string = "0";
 
 bool discord::operator<(const discord::channel &lhs, const discord::channel &rhs)
 {
@@ -36,9 +56,9 @@ bool discord::operator<(const discord::channel &lhs, const discord::channel &rhs
 
 void discord::from_json(const nlohmann::json &json, discord::channel &c)
 {
-    c.id = make_snowflake(json.at("id").get<std::string>());
-    c.guild_id = make_snowflake(get_safe(json, "guild_id", zero_string));
-    c.user_limit = get_safe(json, "user-limit", 0);
+    c.id = make_snowflake(json.at("id"));
+    c.guild_id = get_snowflake_safe(json, "guild_id");
+    c.user_limit = get_safe(json, "user_limit", 0);
     c.bitrate = get_safe(json, "bitrate", 0);
     c.type = json.at("type").get<discord::channel::channel_type>();
     c.name = json.at("name").get<std::string>();
@@ -51,14 +71,15 @@ bool discord::operator<(const discord::guild &lhs, const discord::guild &rhs)
 
 void discord::from_json(const nlohmann::json &json, discord::guild &g)
 {
-    g.id = make_snowflake(json.at("id").get<std::string>());
-    g.owner = make_snowflake(get_safe(json, "owner_id", zero_string));
+    g.id = make_snowflake(json.at("id"));
+    g.owner = get_snowflake_safe(json, "owner_id");
     g.name = json.at("name").get<std::string>();
     g.region = json.at("region").get<std::string>();
     g.unavailable = json.at("unavailable").get<bool>();
-    g.members = json.at("members").get<std::set<discord::member>>();
-    g.channels = json.at("channels").get<std::set<discord::channel>>();
-    g.voice_states = get_safe<std::set<discord::voice_state>>(json, "voice_states", {});
+    g.members = discord::flat_set{json.at("members").get<std::vector<discord::member>>()};
+    g.channels = discord::flat_set{json.at("channels").get<std::vector<discord::channel>>()};
+    g.voice_states = discord::flat_set{
+        get_safe<std::vector<discord::voice_state>>(json, "voice_states", {})};
 }
 
 bool discord::operator<(const discord::member &lhs, const discord::member &rhs)
@@ -79,7 +100,7 @@ bool discord::operator<(const discord::user &lhs, const discord::user &rhs)
 
 void discord::from_json(const nlohmann::json &json, discord::user &u)
 {
-    u.id = make_snowflake(get_safe(json, "id", zero_string));
+    u.id = get_snowflake_safe(json, "id");
     u.discriminator = get_safe(json, "discriminator", empty_string);
     u.name = get_safe(json, "username", empty_string);
 }
@@ -91,8 +112,8 @@ bool discord::operator<(const discord::message &lhs, const discord::message &rhs
 
 void discord::from_json(const nlohmann::json &json, discord::message &m)
 {
-    m.id = make_snowflake(json.at("id").get<std::string>());
-    m.channel_id = make_snowflake(json.at("channel_id").get<std::string>());
+    m.id = make_snowflake(json.at("id"));
+    m.channel_id = make_snowflake(json.at("channel_id"));
     m.author = json.at("author").get<discord::user>();
     m.content = json.at("content").get<std::string>();
     m.type = json.at("type").get<discord::message::message_type>();
@@ -105,9 +126,9 @@ bool discord::operator<(const discord::voice_state &lhs, const discord::voice_st
 
 void discord::from_json(const nlohmann::json &json, discord::voice_state &v)
 {
-    v.guild_id = make_snowflake(get_safe(json, "guild_id", zero_string));
-    v.channel_id = make_snowflake(get_safe(json, "channel_id", zero_string));
-    v.user_id = make_snowflake(json.at("user_id").get<std::string>());
+    v.guild_id = get_snowflake_safe(json, "guild_id");
+    v.channel_id = get_snowflake_safe(json, "channel_id");
+    v.user_id = make_snowflake(json.at("user_id"));
     v.session_id = json.at("session_id").get<std::string>();
     v.deaf = get_safe(json, "deaf", false);
     v.mute = get_safe(json, "mute", false);
@@ -140,6 +161,7 @@ void discord::from_json(const nlohmann::json &json, discord::voice_ready &vr)
     vr.host = json.at("ip").get<std::string>();
     vr.ssrc = json.at("ssrc").get<uint32_t>();
     vr.port = json.at("port").get<uint16_t>();
+    vr.modes = get_safe(json, "modes", std::vector<std::string>{});
 }
 
 void discord::from_json(const nlohmann::json &json, discord::voice_session &vs)
@@ -162,7 +184,509 @@ void discord::event::from_json(const nlohmann::json &json, discord::event::ready
 
 void discord::event::from_json(const nlohmann::json &json, discord::event::voice_server_update &v)
 {
-    v.guild_id = make_snowflake(json.at("guild_id").get<std::string>());
+    v.guild_id = make_snowflake(json.at("guild_id"));
     v.token = json.at("token").get<std::string>();
     v.endpoint = json.at("endpoint").get<std::string>();
 }
+
+namespace
+{
+enum class field {
+    none,
+    op,
+    sequence_num,
+    event_name,
+    data,
+    id,
+    owner_id,
+    name,
+    region,
+    unavailable,
+    members,
+    channels,
+    voice_states,
+    user,
+    nick,
+    username,
+    discriminator,
+    guild_id,
+    user_limit,
+    bitrate,
+    type,
+    channel_id,
+    user_id,
+    session_id,
+    deaf,
+    mute,
+    self_deaf,
+    self_mute,
+    suppress
+};
+
+enum class scope {
+    frame,
+    guild,
+    members,
+    member,
+    user,
+    channels,
+    channel,
+    voice_states,
+    voice_state
+};
+
+struct key_field {
+    const char *key;
+    field f;
+};
+
+// The keys from_json reads for each kind of object
+const key_field frame_keys[] = {
+    {"op", field::op}, {"s", field::sequence_num}, {"t", field::event_name}, {"d", field::data}};
+const key_field guild_keys[] = {{"id", field::id},
+                                {"owner_id", field::owner_id},
+                                {"name", field::name},
+                                {"region", field::region},
+                                {"unavailable", field::unavailable},
+                                {"members", field::members},
+                                {"channels", field::channels},
+                                {"voice_states", field::voice_states}};
+const key_field member_keys[] = {{"user", field::user}, {"nick", field::nick}};
+const key_field user_keys[] = {
+    {"id", field::id}, {"username", field::username}, {"discriminator", field::discriminator}};
+const key_field channel_keys[] = {{"id", field::id},
+                                  {"guild_id", field::guild_id},
+                                  {"user_limit", field::user_limit},
+                                  {"bitrate", field::bitrate},
+                                  {"type", field::type},
+                                  {"name", field::name}};
+const key_field voice_state_keys[] = {
+    {"guild_id", field::guild_id},   {"channel_id", field::channel_id},
+    {"user_id", field::user_id},     {"session_id", field::session_id},
+    {"deaf", field::deaf},           {"mute", field::mute},
+    {"self_deaf", field::self_deaf}, {"self_mute", field::self_mute},
+    {"suppress", field::suppress}};
+
+template<size_t N>
+field find_field(const key_field (&keys)[N], const std::string &key)
+{
+    for (auto &k : keys) {
+        if (key == k.key)
+            return k.f;
+    }
+    return field::none;
+}
+
+constexpr unsigned bit(field f)
+{
+    return 1u << static_cast<unsigned>(f);
+}
+
+// Fields from_json throws without
+unsigned required(scope s)
+{
+    switch (s) {
+        case scope::guild:
+            return bit(field::id) | bit(field::name) | bit(field::region) |
+                   bit(field::unavailable) | bit(field::members) | bit(field::channels);
+        case scope::member:
+            return bit(field::user);
+        case scope::channel:
+            return bit(field::id) | bit(field::type) | bit(field::name);
+        case scope::voice_state:
+            return bit(field::user_id) | bit(field::session_id);
+        default:
+            return 0;
+    }
+}
+
+// Fills a discord::guild straight from nlohmann's SAX events. Values under keys from_json doesn't
+// read are skipped as they're parsed, so roles, presences, emojis and so on cost no allocations
+class guild_reader
+{
+public:
+    // With a payload, the root is a gateway payload and the guild is its "d"
+    guild_reader(discord::payload *p, discord::guild &g) : payload{p}, g{g} {}
+
+    bool null()
+    {
+        pending = field::none;
+        return true;
+    }
+
+    bool boolean(bool b)
+    {
+        if (auto flag = flag_field(take_pending()))
+            *flag = b;
+        return true;
+    }
+
+    bool number_integer(nlohmann::json::number_integer_t i)
+    {
+        return number(i);
+    }
+
+    bool number_unsigned(nlohmann::json::number_unsigned_t u)
+    {
+        return number(static_cast<int64_t>(u));
+    }
+
+    bool number_float(nlohmann::json::number_float_t, const std::string &)
+    {
+        pending = field::none;
+        return true;
+    }
+
+    bool string(std::string &s)
+    {
+        auto f = take_pending();
+        if (auto id = id_field(f))
+            *id = s.empty() ? 0 : make_snowflake(s);
+        else if (auto text = text_field(f))
+            *text = std::move(s);
+        return true;
+    }
+
+    template<typename Binary>
+    bool binary(Binary &)
+    {
+        pending = field::none;
+        return true;
+    }
+
+    bool key(std::string &k)
+    {
+        if (skipping)
+            return true;
+        switch (stack.back().s) {
+            case scope::frame:
+                pending = find_field(frame_keys, k);
+                break;
+            case scope::guild:
+                pending = find_field(guild_keys, k);
+                break;
+            case scope::member:
+                pending = find_field(member_keys, k);
+                break;
+            case scope::user:
+                pending = find_field(user_keys, k);
+                break;
+            case scope::channel:
+                pending = find_field(channel_keys, k);
+                break;
+            case scope::voice_state:
+                pending = find_field(voice_state_keys, k);
+                break;
+            default:
+                pending = field::none;
+                break;
+        }
+        return true;
+    }
+
+    bool start_object(size_t)
+    {
+        if (skipping) {
+            ++skipping;
+            return true;
+        }
+        if (stack.empty()) {
+            stack.push_back({payload ? scope::frame : scope::guild, 0});
+            return true;
+        }
+
+        auto f = take_pending();
+        switch (stack.back().s) {
+            case scope::frame:
+                if (f == field::data) {
+                    // Only a GUILD_CREATE is read here, and "t" has to say so before "d"
+                    if (payload->event_name != "GUILD_CREATE")
+                        return false;
+                    guild_found = true;
+                    return enter(scope::guild);
+                }
+                break;
+            case scope::members:
+                member = {};
+                return enter(scope::member);
+            case scope::member:
+                if (f == field::user)
+                    return enter(scope::user);
+                break;
+            case scope::channels:
+                channel = {};
+                return enter(scope::channel);
+            case scope::voice_states:
+                voice_state = {};
+                return enter(scope::voice_state);
+            default:
+                break;
+        }
+        skipping = 1;
+        return true;
+    }
+
+    bool end_object()
+    {
+        if (skipping) {
+            --skipping;
+            return true;
+        }
+
+        auto done = stack.back();
+        stack.pop_back();
+        if ((done.seen & required(done.s)) != required(done.s)) {
+            error = "guild is missing a required field";
+            return false;
+        }
+        switch (done.s) {
+            case scope::guild:
+                g.members = discord::flat_set{std::move(members)};
+                g.channels = discord::flat_set{std::move(channels)};
+                g.voice_states = discord::flat_set{std::move(voice_states)};
+                break;
+            case scope::member:
+                members.push_back(std::move(member));
+                break;
+            case scope::channel:
+                channels.push_back(std::move(channel));
+                break;
+            case scope::voice_state:
+                voice_states.push_back(std::move(voice_state));
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    bool start_array(size_t)
+    {
+        if (skipping) {
+            ++skipping;
+            return true;
+        }
+
+        auto f = take_pending();
+        if (!stack.empty() && stack.back().s == scope::guild) {
+            switch (f) {
+                case field::members:
+                    return enter(scope::members);
+                case field::channels:
+                    return enter(scope::channels);
+                case field::voice_states:
+                    return enter(scope::voice_states);
+                default:
+                    break;
+            }
+        }
+        skipping = 1;
+        return true;
+    }
+
+    bool end_array()
+    {
+        if (skipping)
+            --skipping;
+        else
+            stack.pop_back();
+        return true;
+    }
+
+    bool parse_error(size_t, const std::string &, const nlohmann::json::exception &e)
+    {
+        error = e.what();
+        return false;
+    }
+
+    std::string error;  // Empty if the parse was stopped because the payload isn't a GUILD_CREATE
+    bool guild_found = false;
+
+private:
+    struct level {
+        scope s;
+        unsigned seen;  // Bits of the fields read so far
+    };
+
+    discord::payload *payload;
+    discord::guild &g;
+    discord::member member;
+    discord::channel channel;
+    discord::voice_state voice_state;
+    std::vector<discord::member> members;  // Sorted into the guild once they're all read
+    std::vector<discord::channel> channels;
+    std::vector<discord::voice_state> voice_states;
+
+    std::vector<level> stack;
+    size_t skipping = 0;  // Depth inside a value that's being skipped
+    field pending = field::none;
+
+    // The field the next value is for, if it's one we read
+    field take_pending()
+    {
+        auto f = skipping ? field::none : pending;
+        pending = field::none;
+        if (f != field::none)
+            stack.back().seen |= bit(f);
+        return f;
+    }
+
+    bool enter(scope s)
+    {
+        stack.push_back({s, 0});
+        return true;
+    }
+
+    bool number(int64_t n)
+    {
+        auto f = take_pending();
+        if (auto id = id_field(f)) {
+            *id = static_cast<discord::snowflake>(n);
+            return true;
+        }
+
+        auto value = static_cast<int>(n);
+        switch (f) {
+            case field::op:
+                payload->op = static_cast<discord::gateway_op>(value);
+                break;
+            case field::sequence_num:
+                payload->sequence_num = value;
+                break;
+            case field::user_limit:
+                channel.user_limit = value;
+                break;
+            case field::bitrate:
+                channel.bitrate = value;
+                break;
+            case field::type:
+                channel.type = static_cast<discord::channel::channel_type>(value);
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+    discord::snowflake *id_field(field f)
+    {
+        switch (stack.empty() ? scope::frame : stack.back().s) {
+            case scope::guild:
+                if (f == field::id)
+                    return &g.id;
+                if (f == field::owner_id)
+                    return &g.owner;
+                break;
+            case scope::user:
+                if (f == field::id)
+                    return &member.user.id;
+                break;
+            case scope::channel:
+                if (f == field::id)
+                    return &channel.id;
+                if (f == field::guild_id)
+                    return &channel.guild_id;
+                break;
+            case scope::voice_state:
+                if (f == field::guild_id)
+                    return &voice_state.guild_id;
+                if (f == field::channel_id)
+                    return &voice_state.channel_id;
+                if (f == field::user_id)
+                    return &voice_state.user_id;
+                break;
+            default:
+                break;
+        }
+        return nullptr;
+    }
+
+    std::string *text_field(field f)
+    {
+        switch (f) {
+            case field::event_name:
+                return &payload->event_name;
+            case field::name:
+                return stack.back().s == scope::guild ? &g.name : &channel.name;
+            case field::region:
+                return &g.region;
+            case field::nick:
+                return &member.nick;
+            case field::username:
+                return &member.user.name;
+            case field::discriminator:
+                return &member.user.discriminator;
+            case field::session_id:
+                return &voice_state.session_id;
+            default:
+                return nullptr;
+        }
+    }
+
+    bool *flag_field(field f)
+    {
+        switch (f) {
+            case field::unavailable:
+                return &g.unavailable;
+            case field::deaf:
+                return &voice_state.deaf;
+            case field::mute:
+                return &voice_state.mute;
+            case field::self_deaf:
+                return &voice_state.self_deaf;
+            case field::self_mute:
+                return &voice_state.self_mute;
+            case field::suppress:
+                return &voice_state.suppress;
+            default:
+                return nullptr;
+        }
+    }
+};
+}  // namespace
+
+discord::guild discord::parse_guild(const char *begin, const char *end)
+{
+    auto g = discord::guild{};
+    auto reader = guild_reader{nullptr, g};
+    if (!nlohmann::json::sax_parse(begin, end, &reader))
+        throw std::runtime_error{reader.error};
+    return g;
+}
+
+bool discord::parse_guild_create(const char *begin, const char *end, discord::payload &p,
+                                 discord::guild &g)
+{
+    p = {};
+    g = {};
+    auto reader = guild_reader{&p, g};
+    if (!nlohmann::json::sax_parse(begin, end, &reader)) {
+        if (!reader.error.empty())
+            throw std::runtime_error{reader.error};
+        return false;
+    }
+    return reader.guild_found;
+}
+
+bool discord::parse_guild_create_etf(const uint8_t *begin, const uint8_t *end,
+                                     discord::payload &p, discord::guild &g)
+{
+    // Erlang sorts small maps by key, so "d" always comes before "t". The rest of the payload is
+    // looked at first, leaving "d" encoded until it's known to be a guild
+    auto fields = etf::map_fields(begin, end);
+    auto t = fields.find("t");
+    auto d = fields.find("d");
+    if (t == fields.end() || d == fields.end() || etf::parse(t->second) != "GUILD_CREATE")
+        return false;
+
+    p = {};
+    p.op = static_cast<discord::gateway_op>(etf::parse(fields.at("op")).get<int>());
+    p.sequence_num = etf::parse(fields.at("s")).get<int>();
+    p.event_name = "GUILD_CREATE";
+
+    g = {};
+    auto reader = guild_reader{nullptr, g};
+    if (!etf::sax_parse(d->second, &reader))
+        throw std::runtime_error{reader.error};
+    return true;
+}
@@ -1,11 +1,12 @@
 #ifndef DISCORD_H
 #define DISCORD_H
 
-#include <set>
 #include <string>
 
 #include <nlohmann/json.hpp>
 
+#include "flat_set.h"
+
 namespace discord
 {
 enum class gateway_op {
@@ -80,9 +81,9 @@ struct voice_state {
 struct guild {
     discord::snowflake id;
     discord::snowflake owner;
-    std::set<channel> channels;
-    std::set<member> members;
-    std::set<voice_state> voice_states;
+    discord::flat_set<channel> channels;
+    discord::flat_set<member> members;
+    discord::flat_set<voice_state> voice_states;
     std::string name;
     std::string region;
     bool unavailable;
@@ -121,6 +122,7 @@ struct voice_ready {
     std::string host;
     uint32_t ssrc;
     uint16_t port;
+    std::vector<std::string> modes;  // Encryption modes the server supports
 };
 
 struct voice_session {
@@ -146,6 +148,19 @@ void from_json(const nlohmann::json &json, discord::voice_payload &vp);
 void from_json(const nlohmann::json &json, discord::voice_ready &vr);
 void from_json(const nlohmann::json &json, discord::voice_session &vs);
 
+// One pass decoders for the bulk of what the gateway sends while connecting. They fill the same
+// structs as from_json straight from the text, skipping whatever from_json doesn't read instead of
+// building a json tree for it. Both throw std::runtime_error for malformed json or missing fields
+discord::guild parse_guild(const char *begin, const char *end);
+
+// p gets everything but data. Returns false if the payload isn't a GUILD_CREATE, or if its "d"
+// comes before "t" so it can't tell in time
+bool parse_guild_create(const char *begin, const char *end, discord::payload &p, discord::guild &g);
+
+// The same for a payload in etf, false if it isn't a GUILD_CREATE
+bool parse_guild_create_etf(const uint8_t *begin, const uint8_t *end, discord::payload &p,
+                            discord::guild &g);
+
 namespace event
 {
 struct hello {
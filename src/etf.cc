@@ -0,0 +1,389 @@
+#include <vector>
+
+#include "etf.h"
+
+namespace
+{
+// Builds a json tree from SAX events
+class json_builder
+{
+public:
+    explicit json_builder(nlohmann::json &root) : root{root} {}
+
+    bool null()
+    {
+        add(nullptr);
+        return true;
+    }
+
+    bool boolean(bool b)
+    {
+        add(b);
+        return true;
+    }
+
+    bool number_integer(nlohmann::json::number_integer_t i)
+    {
+        add(i);
+        return true;
+    }
+
+    bool number_unsigned(nlohmann::json::number_unsigned_t u)
+    {
+        add(u);
+        return true;
+    }
+
+    bool number_float(nlohmann::json::number_float_t f, const std::string &)
+    {
+        add(f);
+        return true;
+    }
+
+    bool string(std::string &s)
+    {
+        add(std::move(s));
+        return true;
+    }
+
+    bool key(std::string &k)
+    {
+        last_key = std::move(k);
+        return true;
+    }
+
+    bool start_object(size_t)
+    {
+        stack.push_back(add(nlohmann::json::object()));
+        return true;
+    }
+
+    bool end_object()
+    {
+        stack.pop_back();
+        return true;
+    }
+
+    bool start_array(size_t)
+    {
+        stack.push_back(add(nlohmann::json::array()));
+        return true;
+    }
+
+    bool end_array()
+    {
+        stack.pop_back();
+        return true;
+    }
+
+private:
+    nlohmann::json &root;
+    std::vector<nlohmann::json *> stack;  // The objects and arrays still being filled
+    std::string last_key;
+
+    nlohmann::json *add(nlohmann::json value)
+    {
+        if (stack.empty()) {
+            root = std::move(value);
+            return &root;
+        }
+
+        auto &parent = *stack.back();
+        if (parent.is_array()) {
+            parent.push_back(std::move(value));
+            return &parent.back();
+        }
+        return &(parent[last_key] = std::move(value));
+    }
+};
+
+void put_u16(std::string &out, uint16_t n)
+{
+    out.push_back(static_cast<char>(n >> 8));
+    out.push_back(static_cast<char>(n));
+}
+
+void put_u32(std::string &out, uint32_t n)
+{
+    put_u16(out, static_cast<uint16_t>(n >> 16));
+    put_u16(out, static_cast<uint16_t>(n));
+}
+
+void put_atom(std::string &out, const std::string &name)
+{
+    out.push_back(static_cast<char>(discord::etf::small_atom_ext));
+    out.push_back(static_cast<char>(name.size()));
+    out += name;
+}
+
+void put_binary(std::string &out, const std::string &s)
+{
+    out.push_back(static_cast<char>(discord::etf::binary_ext));
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+void put_integer(std::string &out, uint64_t magnitude, bool negative)
+{
+    if (!negative && magnitude <= 0xff) {
+        out.push_back(static_cast<char>(discord::etf::small_integer_ext));
+        out.push_back(static_cast<char>(magnitude));
+    } else if (magnitude <= (negative ? 0x80000000ull : 0x7fffffffull)) {
+        out.push_back(static_cast<char>(discord::etf::integer_ext));
+        put_u32(out, static_cast<uint32_t>(negative ? 0 - magnitude : magnitude));
+    } else {
+        // Little endian, as many bytes as it takes
+        out.push_back(static_cast<char>(discord::etf::small_big_ext));
+        auto length_at = out.size();
+        out.push_back(0);
+        out.push_back(negative ? 1 : 0);
+        for (; magnitude; magnitude >>= 8) {
+            out.push_back(static_cast<char>(magnitude & 0xff));
+            out[length_at]++;
+        }
+    }
+}
+
+void put_term(std::string &out, const nlohmann::json &json)
+{
+    switch (json.type()) {
+        case nlohmann::json::value_t::null:
+            put_atom(out, "nil");
+            break;
+        case nlohmann::json::value_t::boolean:
+            put_atom(out, json.get<bool>() ? "true" : "false");
+            break;
+        case nlohmann::json::value_t::number_unsigned:
+            put_integer(out, json.get<uint64_t>(), false);
+            break;
+        case nlohmann::json::value_t::number_integer: {
+            auto n = json.get<int64_t>();
+            put_integer(out, n < 0 ? 0 - static_cast<uint64_t>(n) : n, n < 0);
+            break;
+        }
+        case nlohmann::json::value_t::number_float: {
+            auto value = json.get<double>();
+            auto bits = uint64_t{0};
+            std::memcpy(&bits, &value, sizeof(bits));
+            out.push_back(static_cast<char>(discord::etf::new_float_ext));
+            put_u32(out, static_cast<uint32_t>(bits >> 32));
+            put_u32(out, static_cast<uint32_t>(bits));
+            break;
+        }
+        case nlohmann::json::value_t::string:
+            put_binary(out, json.get_ref<const std::string &>());
+            break;
+        case nlohmann::json::value_t::array:
+            if (!json.empty()) {
+                out.push_back(static_cast<char>(discord::etf::list_ext));
+                put_u32(out, static_cast<uint32_t>(json.size()));
+                for (auto &element : json)
+                    put_term(out, element);
+            }
+            out.push_back(static_cast<char>(discord::etf::nil_ext));
+            break;
+        case nlohmann::json::value_t::object:
+            out.push_back(static_cast<char>(discord::etf::map_ext));
+            put_u32(out, static_cast<uint32_t>(json.size()));
+            for (auto it = json.begin(); it != json.end(); ++it) {
+                put_binary(out, it.key());
+                put_term(out, it.value());
+            }
+            break;
+        default:
+            throw std::runtime_error{"etf: can't encode " + std::string{json.type_name()}};
+    }
+}
+}  // namespace
+
+nlohmann::json discord::etf::parse(const uint8_t *begin, const uint8_t *end)
+{
+    auto json = nlohmann::json{};
+    auto builder = json_builder{json};
+    sax_parse(begin, end, &builder);
+    return json;
+}
+
+nlohmann::json discord::etf::parse(term t)
+{
+    auto json = nlohmann::json{};
+    auto builder = json_builder{json};
+    sax_parse(t, &builder);
+    return json;
+}
+
+std::map<std::string, discord::etf::term> discord::etf::map_fields(const uint8_t *begin,
+                                                                   const uint8_t *end)
+{
+    auto fields = std::map<std::string, term>{};
+    auto c = detail::cursor{begin, end};
+    c.skip_version();
+    for (auto n = c.enter_map(); n > 0; n--) {
+        auto key_begin = c.position();
+        c.skip();
+        auto key = parse(term{key_begin, c.position()});
+        if (!key.is_string())
+            throw std::runtime_error{"etf: map keys have to be atoms or strings"};
+
+        auto value_begin = c.position();
+        c.skip();
+        fields[key.get<std::string>()] = term{value_begin, c.position()};
+    }
+    return fields;
+}
+
+std::string discord::etf::dump(const nlohmann::json &json)
+{
+    auto out = std::string{};
+    out.push_back(static_cast<char>(version));
+    put_term(out, json);
+    return out;
+}
+
+void discord::etf::detail::cursor::skip_version()
+{
+    if (u8() != version)
+        throw std::runtime_error{"etf: unknown version"};
+}
+
+void discord::etf::detail::cursor::skip()
+{
+    switch (u8()) {
+        case small_integer_ext:
+            need(1);
+            pos += 1;
+            break;
+        case integer_ext:
+            need(4);
+            pos += 4;
+            break;
+        case new_float_ext:
+            need(8);
+            pos += 8;
+            break;
+        case float_ext:
+            need(31);
+            pos += 31;
+            break;
+        case atom_ext:
+        case atom_utf8_ext:
+        case string_ext: {
+            auto n = u16();
+            need(n);
+            pos += n;
+            break;
+        }
+        case small_atom_ext:
+        case small_atom_utf8_ext: {
+            auto n = u8();
+            need(n);
+            pos += n;
+            break;
+        }
+        case binary_ext: {
+            auto n = u32();
+            need(n);
+            pos += n;
+            break;
+        }
+        case small_big_ext: {
+            auto n = u8() + size_t{1};
+            need(n);
+            pos += n;
+            break;
+        }
+        case large_big_ext: {
+            auto n = u32() + size_t{1};
+            need(n);
+            pos += n;
+            break;
+        }
+        case small_tuple_ext:
+            for (auto n = u8(); n > 0; n--)
+                skip();
+            break;
+        case large_tuple_ext:
+            for (auto n = u32(); n > 0; n--)
+                skip();
+            break;
+        case list_ext:
+            for (auto n = u32() + size_t{1}; n > 0; n--)  // And the tail
+                skip();
+            break;
+        case map_ext:
+            for (auto n = u32() * size_t{2}; n > 0; n--)
+                skip();
+            break;
+        case nil_ext:
+            break;
+        default:
+            throw std::runtime_error{"etf: unsupported term " + std::to_string(pos[-1])};
+    }
+}
+
+uint32_t discord::etf::detail::cursor::enter_map()
+{
+    if (u8() != map_ext)
+        throw std::runtime_error{"etf: expected a map"};
+    return u32();
+}
+
+const uint8_t *discord::etf::detail::cursor::position() const
+{
+    return pos;
+}
+
+void discord::etf::detail::cursor::need(size_t n)
+{
+    if (static_cast<size_t>(end - pos) < n)
+        throw std::runtime_error{"etf: term is cut short"};
+}
+
+uint8_t discord::etf::detail::cursor::u8()
+{
+    need(1);
+    return *pos++;
+}
+
+uint16_t discord::etf::detail::cursor::u16()
+{
+    need(2);
+    auto n = static_cast<uint16_t>(pos[0] << 8 | pos[1]);
+    pos += 2;
+    return n;
+}
+
+uint32_t discord::etf::detail::cursor::u32()
+{
+    need(4);
+    auto n = static_cast<uint32_t>(pos[0]) << 24 | static_cast<uint32_t>(pos[1]) << 16 |
+             static_cast<uint32_t>(pos[2]) << 8 | pos[3];
+    pos += 4;
+    return n;
+}
+
+uint64_t discord::etf::detail::cursor::u64()
+{
+    auto high = static_cast<uint64_t>(u32());
+    return high << 32 | u32();
+}
+
+std::string &discord::etf::detail::cursor::bytes(size_t n)
+{
+    need(n);
+    text.assign(reinterpret_cast<const char *>(pos), n);
+    pos += n;
+    return text;
+}
+
+uint64_t discord::etf::detail::cursor::big_magnitude(size_t n)
+{
+    if (n > 8)
+        throw std::runtime_error{"etf: integers over 64 bits aren't supported"};
+    need(n);
+    auto magnitude = uint64_t{0};
+    for (auto i = n; i > 0; i--)
+        magnitude = magnitude << 8 | pos[i - 1];
+    pos += n;
+    return magnitude;
+}
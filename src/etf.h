@@ -0,0 +1,238 @@
+#ifndef DISCORD_ETF_H
+#define DISCORD_ETF_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+namespace discord
+{
+// Erlang's external term format, what the gateway speaks with encoding=etf
+namespace etf
+{
+constexpr uint8_t version = 131;
+
+enum tag : uint8_t {
+    new_float_ext = 70,
+    small_integer_ext = 97,
+    integer_ext = 98,
+    float_ext = 99,
+    atom_ext = 100,
+    small_tuple_ext = 104,
+    large_tuple_ext = 105,
+    nil_ext = 106,
+    string_ext = 107,
+    list_ext = 108,
+    binary_ext = 109,
+    small_big_ext = 110,
+    large_big_ext = 111,
+    small_atom_ext = 115,
+    map_ext = 116,
+    atom_utf8_ext = 118,
+    small_atom_utf8_ext = 119
+};
+
+// A single encoded term, without the version in front
+struct term {
+    const uint8_t *begin;
+    const uint8_t *end;
+};
+
+// Decodes into the same events nlohmann's json SAX parser gives, so handlers written for json work
+// unchanged. Maps become objects, lists and tuples arrays, binaries strings, and atoms strings
+// apart from nil, true and false. Returns false if sax stopped it, throws std::runtime_error for
+// anything malformed
+template<typename SAX>
+bool sax_parse(const uint8_t *begin, const uint8_t *end, SAX *sax);
+template<typename SAX>
+bool sax_parse(term t, SAX *sax);
+
+nlohmann::json parse(const uint8_t *begin, const uint8_t *end);
+nlohmann::json parse(term t);
+
+// The values of the map at the root by key, left encoded
+std::map<std::string, term> map_fields(const uint8_t *begin, const uint8_t *end);
+
+// Objects become maps, strings binaries and null the atom nil, as erlpack encodes them
+std::string dump(const nlohmann::json &json);
+
+namespace detail
+{
+class cursor
+{
+public:
+    cursor(const uint8_t *begin, const uint8_t *end) : pos{begin}, end{end} {}
+    void skip_version();
+    void skip();  // Over a whole term
+    uint32_t enter_map();  // Reads up to the first key, returns how many pairs the map has
+    const uint8_t *position() const;
+
+protected:
+    const uint8_t *pos;
+    const uint8_t *end;
+    std::string text;
+
+    void need(size_t n);
+    uint8_t u8();
+    uint16_t u16();
+    uint32_t u32();
+    uint64_t u64();
+    std::string &bytes(size_t n);  // Valid until the next call
+    uint64_t big_magnitude(size_t n);
+};
+
+template<typename SAX>
+class reader : public cursor
+{
+public:
+    reader(const uint8_t *begin, const uint8_t *end, SAX *sax) : cursor{begin, end}, sax{sax} {}
+    bool read();
+
+private:
+    SAX *sax;
+
+    bool atom(size_t n);
+    bool array(size_t n, bool list);
+    bool map(size_t n);
+    bool key();
+    bool big(size_t n);
+};
+}  // namespace detail
+}  // namespace etf
+}  // namespace discord
+
+template<typename SAX>
+bool discord::etf::sax_parse(const uint8_t *begin, const uint8_t *end, SAX *sax)
+{
+    auto r = detail::reader<SAX>{begin, end, sax};
+    r.skip_version();
+    return r.read();
+}
+
+template<typename SAX>
+bool discord::etf::sax_parse(term t, SAX *sax)
+{
+    return detail::reader<SAX>{t.begin, t.end, sax}.read();
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::read()
+{
+    switch (u8()) {
+        case small_integer_ext:
+            return sax->number_unsigned(u8());
+        case integer_ext:
+            return sax->number_integer(static_cast<int32_t>(u32()));
+        case new_float_ext: {
+            auto bits = u64();
+            auto value = 0.0;
+            std::memcpy(&value, &bits, sizeof(value));
+            text.clear();
+            return sax->number_float(value, text);
+        }
+        case float_ext: {
+            auto &digits = bytes(31);
+            return sax->number_float(std::strtod(digits.c_str(), nullptr), digits);
+        }
+        case atom_ext:
+        case atom_utf8_ext:
+            return atom(u16());
+        case small_atom_ext:
+        case small_atom_utf8_ext:
+            return atom(u8());
+        case small_tuple_ext:
+            return array(u8(), false);
+        case large_tuple_ext:
+            return array(u32(), false);
+        case nil_ext:
+            return sax->start_array(0) && sax->end_array();
+        case string_ext:
+            return sax->string(bytes(u16()));
+        case list_ext:
+            return array(u32(), true);
+        case binary_ext:
+            return sax->string(bytes(u32()));
+        case small_big_ext:
+            return big(u8());
+        case large_big_ext:
+            return big(u32());
+        case map_ext:
+            return map(u32());
+        default:
+            throw std::runtime_error{"etf: unsupported term " + std::to_string(pos[-1])};
+    }
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::atom(size_t n)
+{
+    auto &name = bytes(n);
+    if (name == "nil" || name == "null")
+        return sax->null();
+    if (name == "true")
+        return sax->boolean(true);
+    if (name == "false")
+        return sax->boolean(false);
+    return sax->string(name);
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::array(size_t n, bool list)
+{
+    if (!sax->start_array(n))
+        return false;
+    for (auto i = size_t{0}; i < n; i++) {
+        if (!read())
+            return false;
+    }
+    if (list && u8() != nil_ext)
+        throw std::runtime_error{"etf: improper lists aren't supported"};
+    return sax->end_array();
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::map(size_t n)
+{
+    if (!sax->start_object(n))
+        return false;
+    for (auto i = size_t{0}; i < n; i++) {
+        if (!key() || !read())
+            return false;
+    }
+    return sax->end_object();
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::key()
+{
+    switch (u8()) {
+        case atom_ext:
+        case atom_utf8_ext:
+        case string_ext:
+            return sax->key(bytes(u16()));
+        case small_atom_ext:
+        case small_atom_utf8_ext:
+            return sax->key(bytes(u8()));
+        case binary_ext:
+            return sax->key(bytes(u32()));
+        default:
+            throw std::runtime_error{"etf: map keys have to be atoms or strings"};
+    }
+}
+
+template<typename SAX>
+bool discord::etf::detail::reader<SAX>::big(size_t n)
+{
+    auto negative = u8() != 0;
+    auto magnitude = big_magnitude(n);
+    if (negative)
+        return sax->number_integer(-static_cast<int64_t>(magnitude));
+    return sax->number_unsigned(magnitude);
+}
+
+#endif
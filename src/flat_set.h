@@ -0,0 +1,100 @@
+#ifndef DISCORD_FLAT_SET_H
+#define DISCORD_FLAT_SET_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace discord
+{
+// A std::set kept in a sorted vector. Lookups are binary searches over contiguous memory and each
+// element costs only its own size, inserting and erasing move the elements after it
+template<typename T>
+class flat_set
+{
+public:
+    using value_type = T;
+    using const_iterator = typename std::vector<T>::const_iterator;
+    using iterator = const_iterator;
+
+    flat_set() = default;
+
+    // Keeps the first of equal values, like inserting them into a std::set in order would
+    explicit flat_set(std::vector<T> values);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    size_t size() const;
+    bool empty() const;
+
+    const_iterator find(const T &value) const;
+    std::pair<const_iterator, bool> insert(T value);
+    size_t erase(const T &value);
+
+private:
+    std::vector<T> values;
+};
+}  // namespace discord
+
+template<typename T>
+discord::flat_set<T>::flat_set(std::vector<T> v) : values{std::move(v)}
+{
+    std::stable_sort(values.begin(), values.end());
+    auto equal = [](const T &lhs, const T &rhs) { return !(lhs < rhs) && !(rhs < lhs); };
+    values.erase(std::unique(values.begin(), values.end(), equal), values.end());
+    values.shrink_to_fit();
+}
+
+template<typename T>
+typename discord::flat_set<T>::const_iterator discord::flat_set<T>::begin() const
+{
+    return values.begin();
+}
+
+template<typename T>
+typename discord::flat_set<T>::const_iterator discord::flat_set<T>::end() const
+{
+    return values.end();
+}
+
+template<typename T>
+size_t discord::flat_set<T>::size() const
+{
+    return values.size();
+}
+
+template<typename T>
+bool discord::flat_set<T>::empty() const
+{
+    return values.empty();
+}
+
+template<typename T>
+typename discord::flat_set<T>::const_iterator discord::flat_set<T>::find(const T &value) const
+{
+    auto it = std::lower_bound(values.begin(), values.end(), value);
+    if (it == values.end() || value < *it)
+        return values.end();
+    return it;
+}
+
+template<typename T>
+std::pair<typename discord::flat_set<T>::const_iterator, bool> discord::flat_set<T>::insert(T value)
+{
+    auto it = std::lower_bound(values.begin(), values.end(), value);
+    if (it != values.end() && !(value < *it))
+        return {it, false};
+    return {values.insert(it, std::move(value)), true};
+}
+
+template<typename T>
+size_t discord::flat_set<T>::erase(const T &value)
+{
+    auto it = std::lower_bound(values.begin(), values.end(), value);
+    if (it == values.end() || value < *it)
+        return 0;
+    values.erase(it);
+    return 1;
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include <iostream>
+#include <unordered_set>
 
 #include "errors.h"
+#include "etf.h"
 #include "gateway.h"
 #include "voice/voice_connector.h"
 #include "voice/voice_gateway.h"
@@ -20,14 +22,30 @@ static void check_quit(discord::gateway *gateway, boost::asio::io_context &ctx,
     }
 }
 
-discord::gateway::gateway(boost::asio::io_context &ctx, ssl::context &tls, const std::string &token,
-                          discord::connection &c)
-    : conn{c}, beater{ctx}, token{token}, state{connection_state::disconnected}
+// Keeps the parser from building the parts of events no handler reads, which are most of a large
+// GUILD_CREATE. Only applies inside "d", the payload envelope is always kept
+static bool discard_unused(int depth, nlohmann::json::parse_event_t event, nlohmann::json &parsed)
+{
+    static const auto unused = std::unordered_set<std::string>{
+        "activities", "avatar", "banner", "client_status", "description", "emojis", "features",
+        "icon", "joined_at", "last_message_id", "last_pin_timestamp", "permission_overwrites",
+        "permissions", "premium_since", "presences", "rate_limit_per_user", "roles", "splash",
+        "system_channel_id", "topic"};
+
+    if (event != nlohmann::json::parse_event_t::key || depth < 2)
+        return true;
+    return unused.count(parsed.get_ref<const std::string &>()) == 0;
+}
+
+discord::gateway::gateway(boost::asio::io_context &ctx, const io_strand &strand,
+                          const audio_services &audio, ssl::context &tls, const std::string &token,
+                          discord::connection &c, encoding enc)
+    : conn{c}, beater{strand}, token{token}, enc{enc}, state{connection_state::disconnected}
 {
     event_to_handler.emplace("READY", [&](const auto &json) { on_ready(json); });
     event_to_handler.emplace("RESUME", [&](const auto &) { state = connection_state::connected; });
 
-    // gateway_store events
+    // gateway_store events, GUILD_CREATE normally skips these, see handle_message
     event_to_handler.emplace("GUILD_CREATE", [&](const auto &json) { store.guild_create(json); });
     event_to_handler.emplace("CHANNEL_CREATE",
                              [&](const auto &json) { store.channel_create(json); });
@@ -38,7 +56,7 @@ discord::gateway::gateway(boost::asio::io_context &ctx, ssl::context &tls, const
     event_to_handler.emplace("VOICE_STATE_UPDATE",
                              [&](const auto &json) { store.voice_state_update(json); });
 
-    auto handler = std::make_shared<voice_connector>(ctx, tls, *this);
+    auto handler = std::make_shared<voice_connector>(ctx, audio, tls, *this);
     event_to_handler.emplace("VOICE_STATE_UPDATE",
                              [handler](const auto &json) { handler->on_voice_state_update(json); });
     event_to_handler.emplace("VOICE_SERVER_UPDATE", [handler](const auto &json) {
@@ -52,16 +70,17 @@ discord::gateway::gateway(boost::asio::io_context &ctx, ssl::context &tls, const
 
 void discord::gateway::run()
 {
-    conn.connect("wss://gateway.discord.gg/?v=6&encoding=json",
-                 [weak = weak_from_this()](const auto &ec) {
-                     if (auto self = weak.lock()) {
-                         if (ec) {
-                             throw std::runtime_error{"Could not connect: " + ec.message()};
-                         }
-                         self->state = connection_state::connecting;
-                         self->identify();
-                     }
-                 });
+    auto url = std::string{"wss://gateway.discord.gg/?v=6&compress=zlib-stream&encoding="} +
+               (enc == encoding::etf ? "etf" : "json");
+    conn.connect(url, [weak = weak_from_this()](const auto &ec) {
+        if (auto self = weak.lock()) {
+            if (ec) {
+                throw std::runtime_error{"Could not connect: " + ec.message()};
+            }
+            self->state = connection_state::connecting;
+            self->identify();
+        }
+    });
 }
 
 void discord::gateway::disconnect()
@@ -74,12 +93,13 @@ void discord::gateway::disconnect()
 void discord::gateway::heartbeat()
 {
     auto json = nlohmann::json{{"op", static_cast<int>(gateway_op::heartbeat)}, {"d", seq_num}};
-    send(json.dump(), ignore_transfer);
+    send(json, ignore_transfer, connection::coalesce::heartbeat);
 }
 
-void discord::gateway::send(const std::string &s, transfer_cb c)
+void discord::gateway::send(const nlohmann::json &json, transfer_cb c, connection::coalesce kind)
 {
-    conn.send(s, c);
+    auto data = enc == encoding::etf ? etf::dump(json) : json.dump();
+    conn.send(std::move(data), std::move(c), kind);
 }
 
 discord::snowflake discord::gateway::get_user_id() const
@@ -100,7 +120,7 @@ void discord::gateway::identify()
          {{"token", token},
           {"properties",
            {{"$os", "linux"}, {"$browser", "cmd-discord"}, {"$device", "cmd-discord"}}},
-          {"compress", false},
+          {"compress", false},  // The whole connection is compressed instead, see run()
           {"large_threshold", 250}}}};
 
     auto callback = [weak = weak_from_this()](const auto &ec, size_t) {
@@ -113,7 +133,7 @@ void discord::gateway::identify()
             }
         }
     };
-    send(identify_payload.dump(), callback);
+    send(identify_payload, callback);
 }
 
 void discord::gateway::resume()
@@ -132,7 +152,7 @@ void discord::gateway::resume()
     auto resume_payload =
         nlohmann::json{{"op", static_cast<int>(gateway_op::resume)},
                        {"d", {{"token", token}, {"session_id", session_id}, {"seq", seq_num}}}};
-    send(resume_payload.dump(), ignore_transfer);
+    send(resume_payload, ignore_transfer);
 }
 
 void discord::gateway::on_ready(const nlohmann::json &data)
@@ -154,18 +174,48 @@ void discord::gateway::next_event()
 {
     // Asynchronously read next message, on message received send it to listeners
     if (state != connection_state::disconnected)
-        conn.read([weak = weak_from_this()](const auto &ec, const auto &json) {
+        conn.read([weak = weak_from_this()](const auto &ec, const uint8_t *data, size_t size) {
             if (auto self = weak.lock()) {
                 if (ec) {
                     std::cerr << "[gateway] error: " << ec.message() << "\n";
                     self->disconnect();
                 } else {
-                    self->handle_event(json);
+                    self->handle_message(data, size);
                 }
             }
         });
 }
 
+void discord::gateway::handle_message(const uint8_t *data, size_t size)
+{
+    // GUILD_CREATE is most of what's received while connecting to a lot of guilds, so it skips the
+    // json tree and goes straight into the store. Anything else is parsed as usual
+    auto text = reinterpret_cast<const char *>(data);
+    try {
+        auto payload = discord::payload{};
+        auto guild = discord::guild{};
+        auto is_guild_create = enc == encoding::etf
+                                   ? parse_guild_create_etf(data, data + size, payload, guild)
+                                   : parse_guild_create(text, text + size, payload, guild);
+        if (is_guild_create) {
+            std::cout << "[gateway] GUILD_CREATE " << guild.id << " " << guild.name << "\n";
+            seq_num = payload.sequence_num;
+            store.guild_create(std::move(guild));
+            next_event();
+            return;
+        }
+    } catch (std::exception &e) {
+        std::cerr << "[gateway] " << e.what() << "\n";
+        next_event();
+        return;
+    }
+
+    if (enc == encoding::etf)
+        handle_event(etf::parse(data, data + size));
+    else
+        handle_event(nlohmann::json::parse(text, text + size, discard_unused));
+}
+
 void discord::gateway::handle_event(const nlohmann::json &j)
 {
     std::cout << "[gateway] " << j.dump() << "\n";
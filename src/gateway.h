@@ -1,12 +1,14 @@
 #ifndef DISCORD_GATEWAY_H
 #define DISCORD_GATEWAY_H
 
+#include <map>
 #include <memory>
 
 #include <boost/asio/io_context.hpp>
 #include <nlohmann/json.hpp>
 
 #include "aliases.h"
+#include "audio/audio_services.h"
 #include "callbacks.h"
 #include "discord.h"
 #include "gateway_store.h"
@@ -18,13 +20,19 @@ namespace discord
 class gateway : public std::enable_shared_from_this<gateway>
 {
 public:
-    gateway(boost::asio::io_context &ctx, ssl::context &tls, const std::string &token,
-            discord::connection &c);
+    // What the gateway sends and receives, etf is binary and cheaper to decode
+    enum class encoding { json, etf };
+
+    // Runs on strand, which c has to be using too
+    gateway(boost::asio::io_context &ctx, const io_strand &strand, const audio_services &audio,
+            ssl::context &tls, const std::string &token, discord::connection &c,
+            encoding enc = encoding::json);
     ~gateway() = default;
     void run();
     void disconnect();
     void heartbeat();
-    void send(const std::string &s, transfer_cb c);
+    void send(const nlohmann::json &json, transfer_cb c,
+              connection::coalesce kind = connection::coalesce::none);
     discord::snowflake get_user_id() const;
     const std::string &get_session_id() const;
     const discord::gateway_store &get_gateway_store() const;
@@ -40,6 +48,7 @@ private:
     std::multimap<std::string, discord_event_cb> event_to_handler;
 
     std::string token;
+    encoding enc;
     std::string session_id;
     discord::snowflake user_id;
     int seq_num;
@@ -49,6 +58,7 @@ private:
     void resume();
     void on_ready(const nlohmann::json &data);
     void next_event();
+    void handle_message(const uint8_t *data, size_t size);
     void handle_event(const nlohmann::json &j);
     void run_gateway_dispatch(const nlohmann::json &data, const std::string &event_name);
 };
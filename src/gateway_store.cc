@@ -5,25 +5,31 @@
 void discord::gateway_store::guild_create(const nlohmann::json &json)
 {
     try {
-        auto g = json.get<discord::guild>();
-        for (auto &channel : g.channels)
-            channels_to_guild[channel.id] = g.id;
-
-        for (auto &member : g.members)
-            user_to_guilds.insert({member.user.id, g.id});
-
-        guilds[g.id] = std::make_unique<discord::guild>(std::move(g));
+        guild_create(json.get<discord::guild>());
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
     }
 }
 
+void discord::gateway_store::guild_create(discord::guild g)
+{
+    for (auto &channel : g.channels)
+        channels_to_guild[channel.id] = g.id;
+
+    if (auto existing = find_guild(g.id)) {
+        *existing = std::move(g);
+    } else {
+        guild_index[g.id] = static_cast<uint32_t>(guilds.size());
+        guilds.push_back(std::move(g));
+    }
+}
+
 void discord::gateway_store::channel_create(const nlohmann::json &json)
 {
     try {
         auto c = json.get<discord::channel>();
         channels_to_guild[c.id] = c.guild_id;
-        auto g = guilds[c.guild_id].get();
+        auto g = find_guild(c.guild_id);
         if (g) {
             g->channels.insert(c);
         }
@@ -36,7 +42,7 @@ void discord::gateway_store::channel_update(const nlohmann::json &json)
 {
     try {
         auto c = json.get<discord::channel>();
-        auto g = guilds[c.guild_id].get();
+        auto g = find_guild(c.guild_id);
         if (g) {
             // erase old entry, replace with new channel
             g->channels.erase(c);
@@ -51,7 +57,7 @@ void discord::gateway_store::channel_delete(const nlohmann::json &json)
 {
     try {
         auto c = json.get<discord::channel>();
-        auto g = guilds[c.guild_id].get();
+        auto g = find_guild(c.guild_id);
         if (g) {
             g->channels.erase(c);
         }
@@ -65,9 +71,11 @@ void discord::gateway_store::voice_state_update(const nlohmann::json &json)
 {
     try {
         auto vs = json.get<discord::voice_state>();
-        auto g = guilds[vs.guild_id].get();
-        g->voice_states.erase(vs);  // erase any existing voice state information
-        g->voice_states.insert(std::move(vs));
+        auto g = find_guild(vs.guild_id);
+        if (g) {
+            g->voice_states.erase(vs);  // erase any existing voice state information
+            g->voice_states.insert(std::move(vs));
+        }
     } catch (std::exception &e) {
         std::cerr << "[gateway store] " << e.what() << "\n";
     }
@@ -75,16 +83,21 @@ void discord::gateway_store::voice_state_update(const nlohmann::json &json)
 
 const discord::guild *discord::gateway_store::get_guild(discord::snowflake guild_id) const
 {
-    auto it = guilds.find(guild_id);
-    if (it != guilds.end())
-        return it->second.get();
+    auto index = guild_index.find(guild_id);
+    if (index)
+        return &guilds[*index];
     return nullptr;
 }
 
 discord::snowflake discord::gateway_store::lookup_channel(discord::snowflake channel_id) const
 {
-    auto it = channels_to_guild.find(channel_id);
-    if (it == channels_to_guild.end())
+    auto guild_id = channels_to_guild.find(channel_id);
+    if (!guild_id)
         return 0;
-    return it->second;
+    return *guild_id;
+}
+
+discord::guild *discord::gateway_store::find_guild(discord::snowflake guild_id)
+{
+    return const_cast<discord::guild *>(get_guild(guild_id));
 }
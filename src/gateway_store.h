@@ -2,12 +2,11 @@
 #define GATEWAY_STORE_H
 
 #include <nlohmann/json.hpp>
-#include <map>
-#include <memory>
-#include <set>
 #include <string>
+#include <vector>
 
 #include "discord.h"
+#include "snowflake_map.h"
 
 namespace discord
 {
@@ -15,6 +14,7 @@ class gateway_store
 {
 public:
     void guild_create(const nlohmann::json &json);
+    void guild_create(discord::guild g);
     void channel_create(const nlohmann::json &json);
     void channel_update(const nlohmann::json &json);
     void channel_delete(const nlohmann::json &json);
@@ -22,14 +22,15 @@ public:
 
     // Returns the guild_id that the channel is in
     discord::snowflake lookup_channel(discord::snowflake channel_id) const;
+    // Valid until the next guild_create
     const discord::guild *get_guild(discord::snowflake guild_id) const;
 
 private:
-    std::map<discord::snowflake, std::unique_ptr<discord::guild>>
-        guilds;                                                          // guild id to guild struct
-    std::map<discord::snowflake, discord::snowflake> channels_to_guild;  // channel id to guild id
-    std::multimap<discord::snowflake, discord::snowflake>
-        user_to_guilds;  // user id to multiple guild ids
+    std::vector<discord::guild> guilds;
+    discord::snowflake_map<uint32_t> guild_index;                  // guild id to place in guilds
+    discord::snowflake_map<discord::snowflake> channels_to_guild;  // channel id to guild id
+
+    discord::guild *find_guild(discord::snowflake guild_id);
 };
 }  // namespace discord
 
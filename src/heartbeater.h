@@ -6,12 +6,14 @@
 #include <boost/asio/io_context.hpp>
 #include <nlohmann/json.hpp>
 
+#include "aliases.h"
+
 namespace discord
 {
 class heartbeater
 {
 public:
-    heartbeater(boost::asio::io_context &ctx) : timer{ctx}, heartbeat_interval{0}, acked{true} {}
+    heartbeater(const io_strand &strand) : timer{strand}, heartbeat_interval{0}, acked{true} {}
 
     ~heartbeater()
     {
@@ -1,31 +1,61 @@
-#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "aliases.h"
+#include "audio/audio_services.h"
 #include "audio/decoding.h"
 #include "gateway.h"
 #include "net/connection.h"
+#include "voice/crypto.h"
 
-static discord::gateway *gateway_ptr{nullptr};
-static boost::asio::io_context *ctx_ptr{nullptr};
-
-void signal_handler(int)
+// Runs the io_context on the calling thread. An exception escaping a handler stops the other
+// threads too, instead of terminating the process
+static bool run_io(boost::asio::io_context &ctx)
 {
-    if (gateway_ptr)
-        gateway_ptr->disconnect();
-    if (ctx_ptr) {
-        ctx_ptr->restart();
-        ctx_ptr->stop();
+    try {
+        ctx.run();
+        return true;
+    } catch (std::exception &e) {
+        std::cerr << "Exception: " << e.what() << "\n";
+        ctx.stop();
+        return false;
     }
 }
 
+// Stops the io_context and joins the threads running it, however main is left
+struct thread_joiner {
+    boost::asio::io_context &ctx;
+    std::vector<std::thread> threads;
+
+    ~thread_joiner()
+    {
+        join();
+    }
+
+    void join()
+    {
+        ctx.stop();
+        for (auto &thread : threads) {
+            if (thread.joinable())
+                thread.join();
+        }
+    }
+};
+
 int main(int argc, char *argv[])
 {
     try {
         if (argc < 2) {
-            std::cerr << "Usage: " << argv[0] << " <bot token>\n";
+            std::cerr << "Usage: " << argv[0]
+                      << " <bot token> [lookahead seconds] [cache directory] [memory cache MB]"
+                         " [io threads] [json|etf]\n";
             return EXIT_FAILURE;
         }
         auto token = std::string{argv[1]};
@@ -34,24 +64,100 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
-        signal(SIGINT, signal_handler);
+        // Seconds of audio encoded ahead of playback, refilled once half of it is played
+        auto lookahead = lookahead_options{};
+        if (argc > 2) {
+            auto seconds = std::atof(argv[2]);
+            if (seconds < 0.1 || seconds > 30) {
+                std::cerr << "Lookahead should be between 0.1 and 30 seconds\n";
+                return EXIT_FAILURE;
+            }
+            lookahead.lookahead = std::chrono::milliseconds{static_cast<int64_t>(seconds * 1000)};
+            lookahead.low_water = lookahead.lookahead / 2;
+        }
+
+        // Tracks played to the end are kept here, encoded, for the next time they're played
+        auto cache = track_cache{argc > 3 ? argv[3] : ""};
+
+        // Recently played tracks are also kept in memory, guilds playing the same track at the
+        // same time share one encode
+        auto memory_cache_mb = argc > 4 ? std::atol(argv[4]) : 256;
+        if (memory_cache_mb < 0) {
+            std::cerr << "Memory cache size can't be negative\n";
+            return EXIT_FAILURE;
+        }
+        auto memory_cache = track_lru{static_cast<size_t>(memory_cache_mb) * 1024 * 1024};
+
+        // Threads running the io_context, every guild's voice connection runs on its own strand.
+        // hardware_concurrency() is 0 when it can't tell
+        auto io_threads = static_cast<long>(std::max(1u, std::thread::hardware_concurrency()));
+        if (argc > 5) {
+            io_threads = std::atol(argv[5]);
+            if (io_threads < 1) {
+                std::cerr << "There has to be at least 1 io thread\n";
+                return EXIT_FAILURE;
+            }
+        }
+
+        // How the gateway encodes its messages, etf is quicker to decode for bots in many guilds
+        auto encoding = discord::gateway::encoding::json;
+        if (argc > 6) {
+            auto name = std::string{argv[6]};
+            if (name == "etf") {
+                encoding = discord::gateway::encoding::etf;
+            } else if (name != "json") {
+                std::cerr << "The gateway encoding should be json or etf\n";
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Also detects whether the CPU has AES, for the aead_aes256_gcm voice mode
+        if (sodium_init() < 0) {
+            std::cerr << "Could not initialize libsodium\n";
+            return EXIT_FAILURE;
+        }
 
 #ifndef FF_API_NEXT
         av_register_all();
 #endif
         auto ctx = boost::asio::io_context{};
+        // Decoding and encoding of audio runs on its own threads, off the io thread
+        auto audio_pool = boost::asio::thread_pool{};
         auto tls = ssl::context{ssl::context::tls_client};
         tls.set_default_verify_paths();
         tls.set_verify_mode(ssl::context::verify_peer);
 
-        auto gateway_connection = discord::connection{ctx, tls};
-        auto gateway = std::make_shared<discord::gateway>(ctx, tls, token, gateway_connection);
+        // A clock shard per thread, so sending frames is spread over all of them
+        auto clock = discord::audio_clock{ctx, static_cast<size_t>(io_threads)};
+        auto transport = discord::udp_transport{ctx};
+        auto audio = audio_services{audio_pool, lookahead, cache, memory_cache, clock, transport};
+        auto gateway_strand = boost::asio::make_strand(ctx);
+        auto gateway_connection = std::make_shared<discord::connection>(gateway_strand, tls);
+        auto gateway = std::make_shared<discord::gateway>(ctx, gateway_strand, audio, tls, token,
+                                                          *gateway_connection, encoding);
         gateway->run();
 
-        gateway_ptr = gateway.get();
-        ctx_ptr = &ctx;
+        auto signals = boost::asio::signal_set{gateway_strand, SIGINT};
+        signals.async_wait([&](const auto &ec, int) {
+            if (ec)
+                return;
+            gateway->disconnect();
+            ctx.stop();
+        });
 
-        ctx.run();
+        auto failed = std::atomic<bool>{false};
+        auto threads = thread_joiner{ctx, {}};
+        for (auto i = 1L; i < io_threads; i++)
+            threads.threads.emplace_back([&]() {
+                if (!run_io(ctx))
+                    failed = true;
+            });
+        if (!run_io(ctx))
+            failed = true;
+        threads.join();
+        audio_pool.join();
+        if (failed)
+            return EXIT_FAILURE;
     } catch (std::exception &e) {
         std::cerr << "Exception: " << e.what() << "\n";
         return EXIT_FAILURE;
@@ -1,11 +1,12 @@
 #include <boost/asio/connect.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/asio/post.hpp>
+#include <iostream>
 
 #include "connection.h"
 #include "errors.h"
 
-discord::connection::connection(boost::asio::io_context &io, ssl::context &tls)
-    : ctx{io}, resolver{ctx}, websock{ctx, tls}
+discord::connection::connection(const io_strand &strand, ssl::context &tls)
+    : resolver{strand}, websock{strand, tls}, writing{false}
 {
 }
 
@@ -15,8 +16,20 @@ void discord::connection::connect(const std::string &url, error_cb c)
 
     info = uri::parse(url);
 
+    // Each connection is a new zlib stream
+    if (url.find("compress=zlib-stream") != std::string::npos)
+        inflater.emplace();
+    else
+        inflater.reset();
+
+    // etf goes both ways, in binary messages
+    websock.binary(url.find("encoding=etf") != std::string::npos);
+
     auto query = tcp::resolver::query{info.authority, std::to_string(info.port)};
-    resolver.async_resolve(query, [this](const auto &ec, auto it) { on_resolve(ec, it); });
+    resolver.async_resolve(query, [weak = weak_from_this()](const auto &ec, auto it) {
+        if (auto self = weak.lock())
+            self->on_resolve(ec, it);
+    });
 }
 
 void discord::connection::disconnect()
@@ -26,25 +39,116 @@ void discord::connection::disconnect()
     websock.next_layer().lowest_layer().close(ec);
 }
 
-void discord::connection::read(json_cb c)
+void discord::connection::read(json_cb c, nlohmann::json::parser_callback_t filter)
 {
-    websock.async_read(buffer, [c, this](const auto &ec, auto transferred) {
+    read([c, filter = std::move(filter)](const auto &ec, const uint8_t *data, size_t size) {
         auto json = nlohmann::json{};
         if (!ec) {
-            auto data = boost::beast::buffers_to_string(buffer.data());
-            json = nlohmann::json::parse(data);
+            auto begin = reinterpret_cast<const char *>(data);
+            json = nlohmann::json::parse(begin, begin + size, filter);
         }
         c(ec, json);
-        buffer.consume(transferred);
     });
 }
 
-void discord::connection::send(const std::string &s, transfer_cb c)
+void discord::connection::read(data_cb c)
 {
-    // TODO: use strand + message queue + timer for delay
-    auto ec = boost::system::error_code{};
-    auto wrote = websock.write(boost::asio::buffer(s), ec);
-    c(ec, wrote);
+    // The previous message is kept until now for whoever is still looking at it
+    buffer.consume(buffer.size());
+    read_message(std::move(c));
+}
+
+void discord::connection::read_message(data_cb c)
+{
+    websock.async_read(buffer, [c, weak = weak_from_this()](const auto &ec, auto) {
+        auto self = weak.lock();
+        if (!self)
+            return;
+
+        auto &inflater = self->inflater;
+        auto data = self->buffer.data();
+        auto begin = static_cast<const uint8_t *>(data.data());
+        if (ec || !inflater) {
+            c(ec, begin, data.size());
+            return;
+        }
+
+        // A compressed message may be split over several websocket messages, only the last one
+        // ends with a flush
+        if (!zlib_stream::is_flushed(begin, data.size())) {
+            self->read_message(c);
+        } else if (inflater->inflate(begin, data.size())) {
+            c(ec, inflater->data(), inflater->size());
+        } else {
+            std::cerr << "[connection] could not inflate message\n";
+            c(make_error_code(boost::system::errc::bad_message), nullptr, 0);
+        }
+    });
+}
+
+void discord::connection::send(std::string s, transfer_cb c, coalesce kind)
+{
+    // Take the place of a queued message of the same kind, unless it's already being written
+    if (kind != coalesce::none) {
+        auto it = write_queue.begin() + (writing ? 1 : 0);
+        for (; it != write_queue.end(); ++it) {
+            if (it->kind == kind) {
+                fail_later(std::move(it->c), boost::asio::error::operation_aborted);
+                it->data = std::move(s);
+                it->c = std::move(c);
+                return;
+            }
+        }
+    }
+
+    if (write_queue.size() >= max_queued) {
+        std::cerr << "[connection] " << write_queue.size() << " messages queued, dropping one\n";
+        fail_later(std::move(c), boost::asio::error::no_buffer_space);
+        return;
+    }
+    write_queue.push_back({std::move(s), std::move(c), kind});
+    if (!writing)
+        write_next();
+}
+
+void discord::connection::write_next()
+{
+    writing = true;
+    auto &message = write_queue.front();
+    websock.async_write(boost::asio::buffer(message.data),
+                        [self = shared_from_this()](const auto &ec, size_t wrote) {
+                            self->on_write(ec, wrote);
+                        });
+}
+
+void discord::connection::on_write(const boost::system::error_code &ec, size_t wrote)
+{
+    auto written = std::move(write_queue.front());
+    write_queue.pop_front();
+
+    if (ec) {
+        // Nothing after it can be written either
+        auto failed = std::move(write_queue);
+        write_queue.clear();
+        writing = false;
+        written.c(ec, wrote);
+        for (auto &message : failed)
+            message.c(ec, 0);
+        return;
+    }
+
+    // Start on the next message first, the callback may queue another one
+    if (write_queue.empty())
+        writing = false;
+    else
+        write_next();
+    written.c(ec, wrote);
+}
+
+void discord::connection::fail_later(transfer_cb c, const boost::system::error_code &ec)
+{
+    // Not from within send(), the caller may not expect its callback to run yet
+    boost::asio::post(websock.get_executor(), [c = std::move(c), ec]() { c(ec, 0); });
 }
 
 void discord::connection::on_resolve(const boost::system::error_code &ec,
@@ -54,7 +158,10 @@ void discord::connection::on_resolve(const boost::system::error_code &ec,
         connect_cb(ec);
     } else {
         boost::asio::async_connect(websock.next_layer().next_layer(), it,
-                                   [this](const auto &ec, auto it) { on_connect(ec, it); });
+                                   [weak = weak_from_this()](const auto &ec, auto it) {
+                                       if (auto self = weak.lock())
+                                           self->on_connect(ec, it);
+                                   });
     }
 }
 
@@ -66,7 +173,10 @@ void discord::connection::on_connect(const boost::system::error_code &ec, tcp::r
         websock.next_layer().set_verify_mode(ssl::verify_peer);
         websock.next_layer().set_verify_callback(ssl::rfc2818_verification(info.authority));
         websock.next_layer().async_handshake(ssl::stream_base::client,
-                                             [this](const auto &ec) { on_tls_handshake(ec); });
+                                             [weak = weak_from_this()](const auto &ec) {
+                                                 if (auto self = weak.lock())
+                                                     self->on_tls_handshake(ec);
+                                             });
     }
 }
 
@@ -76,7 +186,10 @@ void discord::connection::on_tls_handshake(const boost::system::error_code &ec)
         connect_cb(ec);
     } else {
         websock.async_handshake(info.authority, info.path,
-                                [this](const auto &ec) { on_websocket_handshake(ec); });
+                                [weak = weak_from_this()](const auto &ec) {
+                                    if (auto self = weak.lock())
+                                        self->on_websocket_handshake(ec);
+                                });
     }
 }
 
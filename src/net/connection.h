@@ -4,33 +4,70 @@
 #include "aliases.h"
 #include "callbacks.h"
 #include "net/uri.h"
+#include "net/zlib_stream.h"
 
-#include <boost/beast/core/multi_buffer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
 
 namespace discord
 {
-class connection
+// Owned through a shared_ptr, a write in progress keeps the connection alive until it's done
+class connection : public std::enable_shared_from_this<connection>
 {
 public:
-    connection(boost::asio::io_context &io, ssl::context &tls);
+    // A queued message of a kind other than none is replaced by a newer message of the same kind,
+    // only the latest heartbeat or speaking state is worth sending
+    enum class coalesce { none, heartbeat, speaking };
+
+    connection(const io_strand &strand, ssl::context &tls);
+
+    // A url asking for compress=zlib-stream gets its messages inflated before they're handed out,
+    // one asking for encoding=etf sends binary messages
     void connect(const std::string &url, error_cb c);
     void disconnect();
-    void read(json_cb c);
-    void send(const std::string &s, transfer_cb c);
+    // filter is handed to the json parser, it can drop values nobody will look at before they're
+    // built
+    void read(json_cb c, nlohmann::json::parser_callback_t filter = nullptr);
+
+    // Hands c the message as it was received, or inflated, it stays valid until the next read
+    void read(data_cb c);
+
+    // Queues s to be written once the messages before it are, c is called when it's written or
+    // couldn't be. A full queue fails the message with no_buffer_space instead of holding up the
+    // caller. Has to be called on the connection's strand
+    void send(std::string s, transfer_cb c, coalesce kind = coalesce::none);
     int close_code();
 
 private:
-    boost::asio::io_context &ctx;
+    struct queued_message {
+        std::string data;
+        transfer_cb c;
+        coalesce kind;
+    };
+
+    static constexpr size_t max_queued = 256;
+
     tcp::resolver resolver;
     secure_websocket websock;
-    boost::beast::multi_buffer buffer;
+    boost::beast::flat_buffer buffer;  // Contiguous, so messages are parsed in place
     error_cb connect_cb;
     uri::parsed_uri info;
+    std::optional<zlib_stream> inflater;  // Set for the connection's lifetime if it's compressed
+
+    std::deque<queued_message> write_queue;  // The front is being written while writing is set
+    bool writing;
 
     void on_resolve(const boost::system::error_code &ec, tcp::resolver::iterator it);
     void on_connect(const boost::system::error_code &ec, tcp::resolver::iterator);
     void on_tls_handshake(const boost::system::error_code &ec);
     void on_websocket_handshake(const boost::system::error_code &ec);
+    void read_message(data_cb c);
+    void write_next();
+    void on_write(const boost::system::error_code &ec, size_t wrote);
+    void fail_later(transfer_cb c, const boost::system::error_code &ec);
 };
 }  // namespace discord
 
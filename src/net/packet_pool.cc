@@ -0,0 +1,118 @@
+#include <cassert>
+#include <utility>
+
+#include "net/packet_pool.h"
+
+discord::packet_buffer::packet_buffer(packet_buffer &&other) noexcept
+    : pool{std::exchange(other.pool, nullptr)}
+    , index{other.index}
+    , bytes{std::exchange(other.bytes, nullptr)}
+    , length{std::exchange(other.length, 0)}
+    , reserved{std::exchange(other.reserved, 0)}
+    , heap{std::move(other.heap)}
+{
+}
+
+discord::packet_buffer &discord::packet_buffer::operator=(packet_buffer &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool = std::exchange(other.pool, nullptr);
+        index = other.index;
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+        reserved = std::exchange(other.reserved, 0);
+        heap = std::move(other.heap);
+    }
+    return *this;
+}
+
+discord::packet_buffer::~packet_buffer()
+{
+    release();
+}
+
+uint8_t *discord::packet_buffer::data()
+{
+    return bytes;
+}
+
+const uint8_t *discord::packet_buffer::data() const
+{
+    return bytes;
+}
+
+size_t discord::packet_buffer::size() const
+{
+    return length;
+}
+
+size_t discord::packet_buffer::capacity() const
+{
+    return reserved;
+}
+
+void discord::packet_buffer::resize(size_t size)
+{
+    assert(size <= reserved);
+    length = size;
+}
+
+void discord::packet_buffer::release()
+{
+    if (pool)
+        pool->release(index);
+    pool = nullptr;
+    bytes = nullptr;
+    heap.reset();
+}
+
+discord::packet_pool::packet_pool(size_t count)
+    : storage(count * packet_size), free_list(count), overflow_count{0}
+{
+    for (auto i = size_t{0}; i < count; i++)
+        free_list[i] = static_cast<uint32_t>(count - i - 1);
+}
+
+discord::packet_buffer discord::packet_pool::acquire(size_t size)
+{
+    auto packet = packet_buffer{};
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex};
+        if (size <= packet_size && !free_list.empty()) {
+            packet.pool = this;
+            packet.index = free_list.back();
+            packet.bytes = storage.data() + size_t{packet.index} * packet_size;
+            packet.length = size;
+            packet.reserved = packet_size;
+            free_list.pop_back();
+            return packet;
+        }
+        overflow_count++;
+    }
+
+    // Exhausted, or too large for a pooled buffer
+    packet.heap = std::make_unique<uint8_t[]>(size);
+    packet.bytes = packet.heap.get();
+    packet.length = size;
+    packet.reserved = size;
+    return packet;
+}
+
+size_t discord::packet_pool::available()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return free_list.size();
+}
+
+uint64_t discord::packet_pool::overflows()
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return overflow_count;
+}
+
+void discord::packet_pool::release(uint32_t index)
+{
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    free_list.push_back(index);
+}
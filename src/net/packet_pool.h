@@ -0,0 +1,73 @@
+#ifndef DISCORD_NET_PACKET_POOL_H
+#define DISCORD_NET_PACKET_POOL_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace discord
+{
+class packet_pool;
+
+// A datagram being assembled or waiting to be sent. Its memory goes back to the pool it came
+// from when it's destroyed, i.e. once the datagram has been sent
+class packet_buffer
+{
+public:
+    packet_buffer() = default;
+    packet_buffer(packet_buffer &&other) noexcept;
+    packet_buffer &operator=(packet_buffer &&other) noexcept;
+    ~packet_buffer();
+
+    uint8_t *data();
+    const uint8_t *data() const;
+    size_t size() const;
+    size_t capacity() const;
+    void resize(size_t size);  // Up to capacity()
+
+private:
+    friend class packet_pool;
+
+    packet_pool *pool = nullptr;
+    uint32_t index = 0;
+    uint8_t *bytes = nullptr;
+    size_t length = 0;
+    size_t reserved = 0;
+    std::unique_ptr<uint8_t[]> heap;  // Owns bytes when the pool had nothing to give
+
+    void release();
+};
+
+// Fixed number of preallocated buffers sized for an RTP packet, so sending a frame doesn't
+// allocate. Once they're all in flight, or for an unusually large packet, buffers come from the
+// heap instead and are counted as overflow
+class packet_pool
+{
+public:
+    static constexpr size_t rtp_header_size = 12;
+    static constexpr size_t max_opus_payload = 1275;  // Largest opus frame, RFC 6716
+    static constexpr size_t mac_size = 16;            // crypto_secretbox_MACBYTES
+    static constexpr size_t max_nonce_size = 24;      // Appended by the suffix encryption mode
+    static constexpr size_t packet_size =
+        rtp_header_size + max_opus_payload + mac_size + max_nonce_size;
+
+    explicit packet_pool(size_t count);
+    packet_buffer acquire(size_t size);
+
+    size_t available();
+    uint64_t overflows();
+
+private:
+    friend class packet_buffer;
+
+    std::mutex mutex;
+    std::vector<uint8_t> storage;
+    std::vector<uint32_t> free_list;
+    uint64_t overflow_count;
+
+    void release(uint32_t index);
+};
+}  // namespace discord
+
+#endif
@@ -1,22 +1,30 @@
+#include <boost/asio/post.hpp>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 
 #include "errors.h"
 #include "net/rtp.h"
-#include "voice/crypto.h"
 
-discord::rtp_session::rtp_session(boost::asio::io_context &ctx)
-    : sock{ctx}
-    , resolver{ctx}
-    , timer{ctx}
+static constexpr auto ip_discovery_msg_size = 74U;
+
+discord::rtp_session::rtp_session(const io_strand &strand, udp_transport &transport)
+    : strand{strand}
+    , transport{transport}
+    , resolver{strand}
+    , timer{strand}
     , ssrc{0}
     , timestamp{(uint32_t) rand()}
     , seq_num{(uint16_t) rand()}
     , external_port{0}
-    , buffer(1024)
+    , discovered{false}
+    , buffer(ip_discovery_msg_size)
 {
-    sock.open(udp::v4());
+}
+
+discord::rtp_session::~rtp_session()
+{
+    transport.unsubscribe(ssrc);
 }
 
 void discord::rtp_session::connect(const std::string &host, const std::string &port, error_cb c)
@@ -26,16 +34,13 @@ void discord::rtp_session::connect(const std::string &host, const std::string &p
         if (ec) {
             c(ec);  // host resolve error
         } else {
-            sock.connect(*it);
-            std::cout << "[RTP] udp local: " << sock.local_endpoint()
-                      << " remote: " << sock.remote_endpoint() << "\n";
+            remote = *it;
+            std::cout << "[RTP] udp remote: " << remote << "\n";
             c({});
         }
     });
 }
 
-static constexpr auto ip_discovery_msg_size = 74U;
-
 void discord::rtp_session::ip_discovery(error_cb c)
 {
     std::memset(buffer.data(), 0, ip_discovery_msg_size);
@@ -53,55 +58,49 @@ void discord::rtp_session::ip_discovery(error_cb c)
     // Receive 74 byte payload containing external ip and udp portno
     // Send buffer over socket, timing out after in case of packet loss
 
-    // Let's try retry 5 times if we fail to receive response
-    send_ip_discovery_datagram(5, c);
-
-    auto udp_recv_cb = [=](const auto &ec, auto transferred) {
-        if (ec) {
-            c(ec);
-        } else if (transferred >= ip_discovery_msg_size) {
-            // We got our response, cancel the next send
-            timer.cancel();
+    // The reply comes in on the shared transport, which hands it over by our SSRC. That's off
+    // our strand, the result is handed back to it and the next retry sees we're done
+    discovered = false;
+    auto udp_recv_cb = [=](const uint8_t *data, size_t transferred) {
+        if (transferred < ip_discovery_msg_size || discovered.exchange(true))
+            return transferred >= ip_discovery_msg_size;
 
-            // First 4 bytes of buffer should be SSRC, next is udp socket's external IP
-            external_ip = std::string((char *) &buffer[8]);
+        // First 4 bytes of buffer should be SSRC, next is udp socket's external IP
+        external_ip = std::string((const char *) &data[8]);
 
-            // Last 2 bytes are udp port (little endian)
-            external_port = (buffer[ip_discovery_msg_size - 1] << 8) | buffer[ip_discovery_msg_size - 2];
+        // Last 2 bytes are udp port (little endian)
+        external_port = (data[ip_discovery_msg_size - 1] << 8) | data[ip_discovery_msg_size - 2];
 
-            std::cout << "[RTP] udp socket external addresses " << external_ip << ":"
-                      << external_port << "\n";
-            c({});  // success
-        }
+        std::cout << "[RTP] udp socket external addresses " << external_ip << ":"
+                  << external_port << "\n";
+        boost::asio::post(strand, [c]() { c({}); });  // success
+        return true;
     };
+    transport.subscribe(ssrc, udp_recv_cb);
 
-    // udp_recv_cb isn't called until the socket is closed, or the data is received
-    sock.async_receive(boost::asio::buffer(buffer, buffer.size()), udp_recv_cb);
+    // Let's try retry 5 times if we fail to receive response
+    send_ip_discovery_datagram(5, c);
 }
 
 void discord::rtp_session::send_ip_discovery_datagram(int retries, error_cb c)
 {
-    auto udp_sent_cb = [=](const auto &ec, auto) {
-        if (ec && ec != boost::asio::error::operation_aborted) {
-            std::cerr << "[RTP] could not send udp packet to voice server: " << ec.message()
-                      << "\n";
-        }
-        if (retries == 0) {
-            // Failed to receive response in a reasonable time.
-            // close the socket to complete the async_receive
-            sock.close();
-
+    if (discovered)
+        return;
+    if (retries == 0) {
+        // Failed to receive response in a reasonable time
+        transport.unsubscribe(ssrc);
+        if (!discovered.exchange(true))
             c(voice_errc::ip_discovery_failed);
-            return;
-        }
-        // Next time expires in 200 ms
-        timer.expires_from_now(boost::posix_time::milliseconds(200));
-        timer.async_wait([=](const auto &ec) {
-            if (!ec)
-                send_ip_discovery_datagram(retries - 1, c);
-        });
-    };
-    sock.async_send(boost::asio::buffer(buffer.data(), ip_discovery_msg_size), udp_sent_cb);
+        return;
+    }
+    transport.send(remote, buffer.data(), ip_discovery_msg_size);
+
+    // Next time expires in 200 ms
+    timer.expires_from_now(boost::posix_time::milliseconds(200));
+    timer.async_wait([=](const auto &ec) {
+        if (!ec)
+            send_ip_discovery_datagram(retries - 1, c);
+    });
 }
 
 static void write_rtp_header(unsigned char *buffer, uint16_t seq_num, uint32_t timestamp,
@@ -137,36 +136,25 @@ static void print_rtp_send_info(const boost::system::error_code &ec, size_t tran
 
 void discord::rtp_session::send(const opus_frame &frame)
 {
-    auto size = frame.data.size();
-    auto encrypted_len = size + 12 + crypto_secretbox_MACBYTES;
+    auto size = frame.size;
 
-    // Make sure we have enough room to store the encoded audio, 12 bytes for
-    // RTP header, crypto_secretbox_MACBYTES (for MAC) in buffer
-    if (encrypted_len > buffer.size())
-        buffer.resize(encrypted_len);
-
-    auto buf = buffer.data();
-    auto write_audio = &buf[12];
-    auto nonce = std::array<uint8_t, 24>{};
+    // 12 bytes for RTP header, then the encrypted audio with its MAC and, depending on the mode,
+    // nonce. The frame is encrypted straight from the lookahead queue into its place in the packet
+    auto packet = transport.acquire(12 + cipher.overhead() + size);
+    auto buf = packet.data();
 
     write_rtp_header(buf, seq_num, timestamp, ssrc);
 
-    // First 12 bytes of nonce are RTP header, next 12 are 0s
-    std::memcpy(&nonce[0], buf, 12);
-    std::memset(&nonce[12], 0, 12);
-
     seq_num++;
     timestamp += frame.frame_count;
 
-    auto error = discord::crypto::xsalsa20_poly1305_encrypt(frame.data.data(), write_audio, size,
-                                                            secret_key.data(), nonce.data());
-
-    if (error) {
+    if (cipher.encrypt(buf, frame.data.data(), size)) {
         std::cerr << "[RTP] error encrypting data\n";
         return;
     }
 
-    sock.async_send(boost::asio::buffer(buf, encrypted_len), ignore_transfer);
+    // Goes out with the frames of every other guild sent on this tick
+    transport.send(remote, std::move(packet));
 }
 
 void discord::rtp_session::set_ssrc(uint32_t ssrc)
@@ -174,9 +162,9 @@ void discord::rtp_session::set_ssrc(uint32_t ssrc)
     this->ssrc = ssrc;
 }
 
-void discord::rtp_session::set_secret_key(std::vector<uint8_t> key)
+void discord::rtp_session::set_cipher(crypto::cipher c)
 {
-    secret_key = std::move(key);
+    cipher = std::move(c);
 }
 
 const std::string &discord::rtp_session::get_external_ip() const
@@ -2,6 +2,7 @@
 #define DISCORD_NET_RTP_H
 
 #include <boost/asio/deadline_timer.hpp>
+#include <atomic>
 #include <boost/asio/io_context.hpp>
 #include <cstdint>
 #include <string>
@@ -10,23 +11,28 @@
 #include "aliases.h"
 #include "audio/source.h"
 #include "callbacks.h"
+#include "net/udp_transport.h"
+#include "voice/crypto.h"
 
 namespace discord
 {
 class rtp_session
 {
 public:
-    rtp_session(boost::asio::io_context &ctx);
+    rtp_session(const io_strand &strand, udp_transport &transport);
+    ~rtp_session();
     void connect(const std::string &host, const std::string &port, error_cb c);
     void ip_discovery(error_cb c);
     void send(const opus_frame &frame);
     void set_ssrc(uint32_t ssrc);
-    void set_secret_key(std::vector<uint8_t> key);
+    void set_cipher(crypto::cipher c);
     const std::string &get_external_ip() const;
     uint16_t get_external_port() const;
 
 private:
-    udp::socket sock;
+    io_strand strand;
+    udp_transport &transport;
+    udp::endpoint remote;
     udp::resolver resolver;
     boost::asio::deadline_timer timer;
     uint32_t ssrc;
@@ -34,8 +40,9 @@ private:
     uint16_t seq_num;
     uint16_t external_port;
     std::string external_ip;
+    std::atomic<bool> discovered;  // Set by whichever of reply and last retry comes first
     std::vector<uint8_t> buffer;
-    std::vector<uint8_t> secret_key;
+    crypto::cipher cipher;
 
     void send_ip_discovery_datagram(int retries, error_cb c);
 };
@@ -0,0 +1,211 @@
+#include <boost/asio/post.hpp>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <cerrno>
+#endif
+
+#include "net/udp_transport.h"
+
+discord::udp_transport::udp_transport(boost::asio::io_context &ctx)
+    : strand{boost::asio::make_strand(ctx)}
+    , sock{strand}
+    , pool{1024}
+    , flush_posted{false}
+    , datagrams_sent{0}
+    , datagrams_dropped{0}
+    , send_calls{0}
+{
+    sock.open(udp::v4());
+    sock.bind(udp::endpoint{udp::v4(), 0});
+
+    // A full socket buffer drops the rest of a batch instead of holding up an io thread
+    sock.non_blocking(true);
+    std::cout << "[UDP] voice transport bound to " << sock.local_endpoint() << "\n";
+    receive();
+}
+
+discord::packet_buffer discord::udp_transport::acquire(size_t size)
+{
+    return pool.acquire(size);
+}
+
+void discord::udp_transport::send(const udp::endpoint &to, packet_buffer packet)
+{
+    auto lock = std::lock_guard<std::mutex>{batch_mutex};
+    batch.push_back({to, std::move(packet)});
+
+    if (!flush_posted) {
+        flush_posted = true;
+        boost::asio::post(strand, [this]() { flush(); });
+    }
+}
+
+void discord::udp_transport::send(const udp::endpoint &to, const uint8_t *data, size_t size)
+{
+    auto packet = pool.acquire(size);
+    std::memcpy(packet.data(), data, size);
+    send(to, std::move(packet));
+}
+
+void discord::udp_transport::subscribe(uint32_t ssrc, receive_cb c)
+{
+    auto added = std::make_shared<subscriber>();
+    added->c = std::move(c);
+    added->active = true;
+
+    auto replaced = std::shared_ptr<subscriber>{};
+    {
+        auto lock = std::lock_guard<std::mutex>{subscribers_mutex};
+        replaced = std::exchange(subscribers[ssrc], std::move(added));
+    }
+    if (replaced)
+        deactivate(std::move(replaced));
+}
+
+void discord::udp_transport::unsubscribe(uint32_t ssrc)
+{
+    auto removed = std::shared_ptr<subscriber>{};
+    {
+        auto lock = std::lock_guard<std::mutex>{subscribers_mutex};
+        auto it = subscribers.find(ssrc);
+        if (it == subscribers.end())
+            return;
+        removed = std::move(it->second);
+        subscribers.erase(it);
+    }
+    deactivate(std::move(removed));
+}
+
+void discord::udp_transport::deactivate(std::shared_ptr<subscriber> s)
+{
+    // Waits for its callback to return, unless this is called from within it
+    auto running = std::lock_guard<std::recursive_mutex>{s->running};
+    s->active = false;
+}
+
+std::string discord::udp_transport::stats()
+{
+    auto out = std::ostringstream{};
+    out << datagrams_sent << " datagrams in " << send_calls << " sends, " << datagrams_dropped
+        << " dropped, " << pool.available() << " packet buffers free, " << pool.overflows()
+        << " overflowed";
+    return out.str();
+}
+
+void discord::udp_transport::flush()
+{
+    {
+        // Guilds keep queueing the next batch while this one is sent
+        auto lock = std::lock_guard<std::mutex>{batch_mutex};
+        flush_posted = false;
+        std::swap(batch, sending);
+    }
+
+    auto done = size_t{0};
+    while (done < sending.size()) {
+        auto n = send_some(done);
+        if (n == 0)
+            break;
+        done += n;
+    }
+    datagrams_dropped += sending.size() - done;
+
+    // Sent or dropped, either way the buffers go back to the pool
+    sending.clear();
+}
+
+#ifdef __linux__
+size_t discord::udp_transport::send_some(size_t first)
+{
+    constexpr auto max_batch = size_t{64};
+    auto messages = std::array<mmsghdr, max_batch>{};
+    auto iovecs = std::array<iovec, max_batch>{};
+
+    auto count = std::min(max_batch, sending.size() - first);
+    for (auto i = size_t{0}; i < count; i++) {
+        auto &d = sending[first + i];
+        iovecs[i].iov_base = d.packet.data();
+        iovecs[i].iov_len = d.packet.size();
+        messages[i].msg_hdr.msg_name = d.to.data();
+        messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(d.to.size());
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    send_calls++;
+    auto ret = ::sendmmsg(sock.native_handle(), messages.data(), static_cast<unsigned>(count),
+                          MSG_DONTWAIT);
+    if (ret >= 0) {
+        datagrams_sent += static_cast<size_t>(ret);
+        return static_cast<size_t>(ret);
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+
+    // The first datagram couldn't be sent (e.g. its voice server is unreachable), skip it so it
+    // doesn't hold up the other connections
+    std::cerr << "[UDP] error sending to " << sending[first].to << ": " << std::strerror(errno)
+              << "\n";
+    datagrams_dropped++;
+    return 1;
+}
+#else
+size_t discord::udp_transport::send_some(size_t first)
+{
+    auto &d = sending[first];
+    auto ec = boost::system::error_code{};
+    send_calls++;
+    sock.send_to(boost::asio::buffer(d.packet.data(), d.packet.size()), d.to, 0, ec);
+    if (ec == boost::asio::error::would_block)
+        return 0;
+    if (ec) {
+        std::cerr << "[UDP] error sending to " << d.to << ": " << ec.message() << "\n";
+        datagrams_dropped++;
+    } else {
+        datagrams_sent++;
+    }
+    return 1;
+}
+#endif
+
+void discord::udp_transport::receive()
+{
+    auto receive_cb = [this](const auto &ec, size_t transferred) {
+        if (ec == boost::asio::error::operation_aborted)
+            return;
+
+        if (!ec && transferred >= 8) {
+            auto data = receive_buffer.data();
+            auto ssrc = (uint32_t{data[4]} << 24) | (uint32_t{data[5]} << 16) |
+                        (uint32_t{data[6]} << 8) | uint32_t{data[7]};
+
+            // The callback is called without the subscribers locked, it may subscribe or
+            // unsubscribe
+            auto found = std::shared_ptr<subscriber>{};
+            {
+                auto lock = std::lock_guard<std::mutex>{subscribers_mutex};
+                auto it = subscribers.find(ssrc);
+                if (it != subscribers.end())
+                    found = it->second;
+            }
+            if (found) {
+                auto running = std::lock_guard<std::recursive_mutex>{found->running};
+                if (found->active && found->c(data, transferred)) {
+                    found->active = false;
+                    auto lock = std::lock_guard<std::mutex>{subscribers_mutex};
+                    auto it = subscribers.find(ssrc);
+                    if (it != subscribers.end() && it->second == found)
+                        subscribers.erase(it);
+                }
+            }
+        }
+        receive();
+    };
+    sock.async_receive_from(boost::asio::buffer(receive_buffer), sender, receive_cb);
+}
@@ -0,0 +1,80 @@
+#ifndef DISCORD_NET_UDP_TRANSPORT_H
+#define DISCORD_NET_UDP_TRANSPORT_H
+
+#include <array>
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aliases.h"
+#include "net/packet_pool.h"
+
+namespace discord
+{
+// One UDP socket shared by every voice connection. Datagrams sent while handling an event, e.g.
+// an audio_clock tick sending every guild's frames, are queued and go out together on the next
+// turn of the io_context: with a single sendmmsg() on Linux, one send_to() each elsewhere.
+// Datagrams are assembled in buffers from the transport's packet pool, which go back to it once
+// the batch has been sent. Replies are handed to whoever subscribed to the SSRC they carry.
+// Datagrams can be sent from any thread, the socket itself is only used on the transport's strand
+class udp_transport
+{
+public:
+    explicit udp_transport(boost::asio::io_context &ctx);
+    packet_buffer acquire(size_t size);
+    void send(const udp::endpoint &to, packet_buffer packet);
+    void send(const udp::endpoint &to, const uint8_t *data, size_t size);  // Queues a copy
+
+    // IP discovery replies carry the SSRC they're for at offset 4, anything else is ignored. The
+    // callback runs on the transport's strand, outside of the subscriber lock so it can subscribe
+    // and unsubscribe itself, and returns true once it's done, which unsubscribes it.
+    // unsubscribe() waits for a callback that's running on another thread
+    using receive_cb = std::function<bool(const uint8_t *data, size_t size)>;
+    void subscribe(uint32_t ssrc, receive_cb c);
+    void unsubscribe(uint32_t ssrc);
+
+    std::string stats();
+
+private:
+    struct datagram {
+        udp::endpoint to;
+        packet_buffer packet;
+    };
+
+    io_strand strand;
+    udp::socket sock;
+    packet_pool pool;
+
+    std::mutex batch_mutex;
+    std::vector<datagram> batch;    // Queued by send()
+    std::vector<datagram> sending;  // Swapped with batch by flush(), only used on the strand
+    bool flush_posted;
+
+    std::array<uint8_t, 1500> receive_buffer;
+    udp::endpoint sender;
+    struct subscriber {
+        receive_cb c;
+        std::recursive_mutex running;  // Held while c runs
+        bool active;                   // Cleared once unsubscribed, under running
+    };
+    std::mutex subscribers_mutex;  // Only held to look subscribers up
+    std::map<uint32_t, std::shared_ptr<subscriber>> subscribers;
+
+    std::atomic<uint64_t> datagrams_sent;
+    std::atomic<uint64_t> datagrams_dropped;
+    std::atomic<uint64_t> send_calls;
+
+    void flush();
+    size_t send_some(size_t first);  // Returns how many datagrams were sent or dropped, 0 if full
+    void receive();
+    void deactivate(std::shared_ptr<subscriber> s);
+};
+}  // namespace discord
+
+#endif
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "zlib_stream.h"
+
+discord::zlib_stream::zlib_stream() : stream{}, inflated(64 * 1024), length{0}
+{
+    if (inflateInit(&stream) != Z_OK)
+        throw std::runtime_error{"Could not initialize zlib"};
+}
+
+discord::zlib_stream::~zlib_stream()
+{
+    inflateEnd(&stream);
+}
+
+bool discord::zlib_stream::is_flushed(const uint8_t *data, size_t size)
+{
+    static const uint8_t suffix[] = {0x00, 0x00, 0xff, 0xff};
+    return size >= sizeof(suffix) && std::equal(suffix, suffix + sizeof(suffix), data + size - 4);
+}
+
+bool discord::zlib_stream::inflate(const uint8_t *data, size_t size)
+{
+    stream.next_in = const_cast<Bytef *>(data);
+    stream.avail_in = static_cast<uInt>(size);
+    length = 0;
+
+    // Until all of the input is used and zlib had room to spare, i.e. nothing's left to flush
+    do {
+        if (inflated.size() == length)
+            inflated.resize(inflated.size() * 2);
+        stream.next_out = inflated.data() + length;
+        stream.avail_out = static_cast<uInt>(inflated.size() - length);
+
+        auto result = ::inflate(&stream, Z_SYNC_FLUSH);
+        length = inflated.size() - stream.avail_out;
+        if (result == Z_BUF_ERROR && stream.avail_in == 0)
+            break;  // Everything was already flushed
+        if (result != Z_OK)
+            return false;
+    } while (stream.avail_in > 0 || stream.avail_out == 0);
+
+    return true;
+}
+
+const uint8_t *discord::zlib_stream::data() const
+{
+    return inflated.data();
+}
+
+size_t discord::zlib_stream::size() const
+{
+    return length;
+}
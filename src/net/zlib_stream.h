@@ -0,0 +1,37 @@
+#ifndef DISCORD_NET_ZLIB_STREAM_H
+#define DISCORD_NET_ZLIB_STREAM_H
+
+#include <cstdint>
+#include <vector>
+#include <zlib.h>
+
+namespace discord
+{
+// Inflates the gateway's zlib-stream transport compression, where the whole connection is a single
+// zlib stream and every message ends with a sync flush. The inflate context and its window are
+// kept for the life of the connection, as later messages refer back to earlier ones
+class zlib_stream
+{
+public:
+    zlib_stream();
+    zlib_stream(const zlib_stream &) = delete;
+    zlib_stream &operator=(const zlib_stream &) = delete;
+    ~zlib_stream();
+
+    // Whether data ends with the flush marking the end of a message, if not more is on its way
+    static bool is_flushed(const uint8_t *data, size_t size);
+
+    // Inflates a whole message into a buffer that's reused by the next call, false if the stream
+    // is corrupt
+    bool inflate(const uint8_t *data, size_t size);
+    const uint8_t *data() const;
+    size_t size() const;
+
+private:
+    z_stream stream;
+    std::vector<uint8_t> inflated;
+    size_t length;
+};
+}  // namespace discord
+
+#endif
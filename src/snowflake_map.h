@@ -0,0 +1,131 @@
+#ifndef DISCORD_SNOWFLAKE_MAP_H
+#define DISCORD_SNOWFLAKE_MAP_H
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "discord.h"
+
+namespace discord
+{
+// A hash map from snowflakes, open addressing with linear probing in one flat array of slots. No
+// snowflake is 0, so a key of 0 marks an empty slot
+template<typename V>
+class snowflake_map
+{
+public:
+    V *find(snowflake key);
+    const V *find(snowflake key) const;
+    V &operator[](snowflake key);  // Inserts a default constructed value if there isn't one
+    bool erase(snowflake key);
+    size_t size() const;
+
+private:
+    struct slot {
+        snowflake key = 0;
+        V value{};
+    };
+
+    std::vector<slot> slots;  // A power of two of them, at most half used
+    size_t count = 0;
+
+    size_t home(snowflake key) const;
+    size_t locate(snowflake key) const;  // The key's slot, or the empty one it would go in
+    void grow();
+};
+}  // namespace discord
+
+template<typename V>
+V *discord::snowflake_map<V>::find(snowflake key)
+{
+    return const_cast<V *>(static_cast<const snowflake_map *>(this)->find(key));
+}
+
+template<typename V>
+const V *discord::snowflake_map<V>::find(snowflake key) const
+{
+    if (key == 0 || slots.empty())
+        return nullptr;
+    auto &s = slots[locate(key)];
+    return s.key == key ? &s.value : nullptr;
+}
+
+template<typename V>
+V &discord::snowflake_map<V>::operator[](snowflake key)
+{
+    if (key == 0)
+        throw std::invalid_argument{"snowflake_map: 0 isn't a snowflake"};
+    if ((count + 1) * 2 > slots.size())
+        grow();
+
+    auto &s = slots[locate(key)];
+    if (s.key != key) {
+        s.key = key;
+        count++;
+    }
+    return s.value;
+}
+
+template<typename V>
+bool discord::snowflake_map<V>::erase(snowflake key)
+{
+    if (key == 0 || slots.empty())
+        return false;
+    auto hole = locate(key);
+    if (slots[hole].key != key)
+        return false;
+
+    // Shift back the entries after it that would no longer be found past the hole, instead of
+    // leaving a tombstone
+    auto mask = slots.size() - 1;
+    for (auto next = (hole + 1) & mask; slots[next].key != 0; next = (next + 1) & mask) {
+        auto wanted = home(slots[next].key);
+        auto reachable = hole <= next ? (hole < wanted && wanted <= next)
+                                      : (hole < wanted || wanted <= next);
+        if (!reachable) {
+            slots[hole] = std::move(slots[next]);
+            hole = next;
+        }
+    }
+    slots[hole] = slot{};
+    count--;
+    return true;
+}
+
+template<typename V>
+size_t discord::snowflake_map<V>::size() const
+{
+    return count;
+}
+
+template<typename V>
+size_t discord::snowflake_map<V>::home(snowflake key) const
+{
+    // Snowflakes' low bits are a per process counter, mix in the rest
+    auto h = key * 0x9e3779b97f4a7c15ull;
+    return static_cast<size_t>(h ^ (h >> 32)) & (slots.size() - 1);
+}
+
+template<typename V>
+size_t discord::snowflake_map<V>::locate(snowflake key) const
+{
+    auto mask = slots.size() - 1;
+    auto i = home(key);
+    while (slots[i].key != 0 && slots[i].key != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+template<typename V>
+void discord::snowflake_map<V>::grow()
+{
+    auto old = std::move(slots);
+    slots = std::vector<slot>(old.empty() ? 16 : old.size() * 2);
+    for (auto &s : old) {
+        if (s.key != 0)
+            slots[locate(s.key)] = std::move(s);
+    }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <sstream>
+
+#include "voice/audio_clock.h"
+#include "voice/voice_connector.h"
+
+discord::audio_clock::shard::shard(boost::asio::io_context &ctx, size_t index)
+    : index{index}, strand{boost::asio::make_strand(ctx)}, timer{strand}, running{false}
+{
+}
+
+discord::audio_clock::audio_clock(boost::asio::io_context &ctx, size_t shards)
+{
+    for (auto i = size_t{0}; i < std::max<size_t>(shards, 1); i++)
+        this->shards.push_back(std::make_unique<shard>(ctx, i));
+}
+
+void discord::audio_clock::add(const std::shared_ptr<voice_context> &guild)
+{
+    auto &s = shard_of(*guild);
+    auto lock = std::lock_guard<std::mutex>{s.mutex};
+    s.guilds.push_back(guild);
+    if (!s.running) {
+        s.running = true;
+        boost::asio::post(s.strand, [this, &s]() { start(s); });
+    }
+}
+
+void discord::audio_clock::remove(const voice_context *guild)
+{
+    // Only cleared here, the shard drops it after its next tick. A guild may remove itself from
+    // its own on_tick()
+    auto &s = shard_of(*guild);
+    auto lock = std::lock_guard<std::mutex>{s.mutex};
+    for (auto &weak : s.guilds) {
+        if (auto g = weak.lock(); g.get() == guild)
+            weak.reset();
+    }
+}
+
+std::string discord::audio_clock::stats() const
+{
+    auto out = std::ostringstream{};
+    for (auto i = size_t{0}; i < shards.size(); i++) {
+        auto lock = std::lock_guard<std::mutex>{shards[i]->mutex};
+        out << "shard " << i << ": " << shards[i]->guilds.size() << " guilds, "
+            << shards[i]->pacing.stats() << (i + 1 < shards.size() ? "; " : "");
+    }
+    return out.str();
+}
+
+discord::audio_clock::shard &discord::audio_clock::shard_of(const voice_context &guild)
+{
+    return *shards[guild.get_guild_id() % shards.size()];
+}
+
+void discord::audio_clock::start(shard &s)
+{
+    {
+        auto lock = std::lock_guard<std::mutex>{s.mutex};
+        s.pacing.reset();
+    }
+
+    // Shards tick at different points of the 20ms period
+    s.timer.expires_after(std::chrono::microseconds{20000 * s.index / shards.size()});
+    s.timer.async_wait([this, &s](const auto &ec) {
+        if (!ec)
+            tick(s);
+    });
+}
+
+void discord::audio_clock::tick(shard &s)
+{
+    auto deadline = pacing_clock::clock::time_point{};
+    auto running = true;
+    {
+        auto lock = std::lock_guard<std::mutex>{s.mutex};
+        deadline = s.pacing.sent(tick_samples);
+        for (const auto &weak : s.guilds) {
+            if (auto guild = weak.lock())
+                s.due.push_back(std::move(guild));
+        }
+        s.guilds.erase(std::remove_if(s.guilds.begin(), s.guilds.end(),
+                                      [](const auto &weak) { return weak.expired(); }),
+                       s.guilds.end());
+
+        // Nobody's playing, stop waking up until a guild is added again
+        running = s.running = !s.guilds.empty();
+    }
+
+    // Every guild sends its frames on its own strand
+    for (auto &guild : s.due) {
+        boost::asio::post(guild->get_strand(),
+                          [guild = std::move(guild)]() { guild->on_tick(tick_samples); });
+    }
+    s.due.clear();
+
+    // A guild added from now on starts the shard again
+    if (!running)
+        return;
+    s.timer.expires_at(deadline);
+    s.timer.async_wait([this, &s](const auto &ec) {
+        if (!ec)
+            tick(s);
+    });
+}
@@ -0,0 +1,59 @@
+#ifndef DISCORD_VOICE_AUDIO_CLOCK_H
+#define DISCORD_VOICE_AUDIO_CLOCK_H
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aliases.h"
+#include "voice/pacing_clock.h"
+
+namespace discord
+{
+struct voice_context;
+
+// Sends the frames of every playing guild from one timer, instead of a timer per guild. Each
+// 20ms tick hands every guild another tick of samples to send, see voice_context::on_tick().
+// Guilds are split over shards with their own timer, their ticks are spread out over the 20ms so
+// the frames of all guilds aren't sent in one burst. Each shard runs on its own strand and posts
+// the ticks to the guilds' strands, so the guilds of a shard are sent on all io threads
+class audio_clock
+{
+public:
+    audio_clock(boost::asio::io_context &ctx, size_t shards = 1);
+
+    // The guild is ticked until it's removed, or goes away. Both can be called from any thread
+    void add(const std::shared_ptr<voice_context> &guild);
+    void remove(const voice_context *guild);
+
+    std::string stats() const;
+
+private:
+    static constexpr int tick_samples = 960;  // 20ms at 48kHz
+
+    struct shard {
+        shard(boost::asio::io_context &ctx, size_t index);
+
+        size_t index;
+        io_strand strand;
+        boost::asio::steady_timer timer;
+
+        std::mutex mutex;  // Guards the rest
+        pacing_clock pacing;
+        std::vector<std::weak_ptr<voice_context>> guilds;
+        std::vector<std::shared_ptr<voice_context>> due;  // Reused by every tick
+        bool running;
+    };
+
+    std::vector<std::unique_ptr<shard>> shards;
+
+    shard &shard_of(const voice_context &guild);
+    void start(shard &s);
+    void tick(shard &s);
+};
+}  // namespace discord
+
+#endif
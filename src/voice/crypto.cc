@@ -1,7 +1,164 @@
+#include <array>
+#include <cstring>
+
 #include "voice/crypto.h"
 
-int discord::crypto::xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
-                                               uint8_t *secret_key, uint8_t *nonce)
+static constexpr auto rtp_header_size = size_t{12};
+static constexpr auto lite_nonce_size = size_t{4};
+
+// Cheapest first
+static constexpr discord::crypto::mode preferred_modes[] = {
+    discord::crypto::mode::aead_aes256_gcm,
+    discord::crypto::mode::xsalsa20_poly1305_lite,
+    discord::crypto::mode::xsalsa20_poly1305,
+    discord::crypto::mode::xsalsa20_poly1305_suffix,
+};
+
+int discord::crypto::xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint8_t *mac,
+                                               uint64_t src_len, const uint8_t *secret_key,
+                                               const uint8_t *nonce)
+{
+    return crypto_secretbox_detached(dest, mac, src, src_len, nonce, secret_key);
+}
+
+const char *discord::crypto::mode_name(mode m)
+{
+    switch (m) {
+        case mode::aead_aes256_gcm:
+            return "aead_aes256_gcm";
+        case mode::xsalsa20_poly1305_lite:
+            return "xsalsa20_poly1305_lite";
+        case mode::xsalsa20_poly1305:
+            return "xsalsa20_poly1305";
+        case mode::xsalsa20_poly1305_suffix:
+            return "xsalsa20_poly1305_suffix";
+    }
+    return "unknown";
+}
+
+bool discord::crypto::parse_mode(const std::string &name, mode &m)
+{
+    for (auto candidate : preferred_modes) {
+        if (name == mode_name(candidate)) {
+            m = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool discord::crypto::aes256gcm_available()
+{
+    return crypto_aead_aes256gcm_is_available() == 1;
+}
+
+bool discord::crypto::choose_mode(const std::vector<std::string> &offered, mode &m)
+{
+    if (offered.empty()) {
+        m = mode::xsalsa20_poly1305;
+        return true;
+    }
+
+    // Without AES-NI libsodium has no AES-GCM, fall back to the cheapest XSalsa20 mode
+    auto aes = aes256gcm_available();
+    for (auto candidate : preferred_modes) {
+        if (candidate == mode::aead_aes256_gcm && !aes)
+            continue;
+        for (const auto &name : offered) {
+            if (name == mode_name(candidate)) {
+                m = candidate;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+discord::crypto::cipher::cipher() : m{mode::xsalsa20_poly1305}, aes_state{}, counter{0}
+{
+}
+
+discord::crypto::cipher::cipher(mode m, std::vector<uint8_t> key)
+    : m{m}, key{std::move(key)}, aes_state{}, counter{randombytes_random()}
+{
+    // The key schedule is computed once instead of for every packet
+    if (m == mode::aead_aes256_gcm)
+        crypto_aead_aes256gcm_beforenm(&aes_state, this->key.data());
+}
+
+discord::crypto::mode discord::crypto::cipher::get_mode() const
+{
+    return m;
+}
+
+size_t discord::crypto::cipher::overhead() const
+{
+    switch (m) {
+        case mode::aead_aes256_gcm:
+            return crypto_aead_aes256gcm_ABYTES + lite_nonce_size;
+        case mode::xsalsa20_poly1305_lite:
+            return crypto_secretbox_MACBYTES + lite_nonce_size;
+        case mode::xsalsa20_poly1305:
+            return crypto_secretbox_MACBYTES;
+        case mode::xsalsa20_poly1305_suffix:
+            return crypto_secretbox_MACBYTES + crypto_secretbox_NONCEBYTES;
+    }
+    return crypto_secretbox_MACBYTES;
+}
+
+int discord::crypto::cipher::encrypt(uint8_t *packet, const uint8_t *payload, size_t size)
+{
+    if (m == mode::aead_aes256_gcm)
+        return encrypt_aes256gcm(packet, payload, size);
+
+    auto mac = packet + rtp_header_size;
+    auto audio = mac + crypto_secretbox_MACBYTES;
+    auto suffix = audio + size;
+    auto nonce = std::array<uint8_t, crypto_secretbox_NONCEBYTES>{};
+
+    switch (m) {
+        case mode::xsalsa20_poly1305_lite:
+            // Big endian counter followed by 0s, only the counter is sent
+            write_counter(nonce.data());
+            std::memcpy(suffix, nonce.data(), lite_nonce_size);
+            break;
+        case mode::xsalsa20_poly1305:
+            // First 12 bytes of nonce are RTP header, next 12 are 0s
+            std::memcpy(nonce.data(), packet, rtp_header_size);
+            break;
+        case mode::xsalsa20_poly1305_suffix:
+            randombytes_buf(nonce.data(), nonce.size());
+            std::memcpy(suffix, nonce.data(), nonce.size());
+            break;
+        case mode::aead_aes256_gcm:
+            break;
+    }
+    return xsalsa20_poly1305_encrypt(payload, audio, mac, size, key.data(), nonce.data());
+}
+
+int discord::crypto::cipher::encrypt_aes256gcm(uint8_t *packet, const uint8_t *payload, size_t size)
+{
+    // The RTP header is authenticated but not encrypted, the tag follows the encrypted audio and
+    // then the counter the nonce starts with
+    auto audio = packet + rtp_header_size;
+    auto tag = audio + size;
+    auto suffix = tag + crypto_aead_aes256gcm_ABYTES;
+    auto nonce = std::array<uint8_t, crypto_aead_aes256gcm_NPUBBYTES>{};
+
+    write_counter(nonce.data());
+    std::memcpy(suffix, nonce.data(), lite_nonce_size);
+
+    auto tag_len = 0ULL;
+    return crypto_aead_aes256gcm_encrypt_detached_afternm(audio, tag, &tag_len, payload, size,
+                                                          packet, rtp_header_size, nullptr,
+                                                          nonce.data(), &aes_state);
+}
+
+void discord::crypto::cipher::write_counter(uint8_t *nonce)
 {
-    return crypto_secretbox_easy(dest, src, src_len, nonce, secret_key);
+    nonce[0] = (counter >> 24) & 0xFF;
+    nonce[1] = (counter >> 16) & 0xFF;
+    nonce[2] = (counter >> 8) & 0xFF;
+    nonce[3] = (counter >> 0) & 0xFF;
+    counter++;
 }
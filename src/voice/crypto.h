@@ -3,14 +3,61 @@
 
 #include <sodium.h>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 namespace discord
 {
 namespace crypto
 {
-int xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint64_t src_len,
-                              uint8_t *secret_key, uint8_t *nonce);
-}
+// Encrypts src_len bytes from src into dest and writes the MAC to mac, dest may be src
+int xsalsa20_poly1305_encrypt(const uint8_t *src, uint8_t *dest, uint8_t *mac, uint64_t src_len,
+                              const uint8_t *secret_key, const uint8_t *nonce);
+
+// Voice encryption modes, cheapest first
+enum class mode {
+    aead_aes256_gcm,           // Only with hardware AES, 4 byte counter appended to the packet
+    xsalsa20_poly1305_lite,    // 4 byte counter appended to the packet
+    xsalsa20_poly1305,         // RTP header is the nonce
+    xsalsa20_poly1305_suffix,  // 24 random bytes appended to the packet
+};
+
+const char *mode_name(mode m);
+bool parse_mode(const std::string &name, mode &m);
+
+// Whether AES-GCM runs on hardware AES here, sodium_init() has to be called first
+bool aes256gcm_available();
+
+// Picks the cheapest supported mode of the ones offered by the voice server, AES-GCM only if
+// aes256gcm_available(). Servers that don't list their modes get xsalsa20_poly1305
+bool choose_mode(const std::vector<std::string> &offered, mode &m);
+
+// Encrypts the audio in the RTP packets of one voice connection
+class cipher
+{
+public:
+    cipher();
+    cipher(mode m, std::vector<uint8_t> key);
+
+    mode get_mode() const;
+
+    // Bytes the packet grows by: the MAC, and the nonce for modes that append it
+    size_t overhead() const;
+
+    // packet starts with the 12 byte RTP header, size bytes of payload are encrypted after it and
+    // followed by the nonce if the mode appends one. Returns non-zero on failure
+    int encrypt(uint8_t *packet, const uint8_t *payload, size_t size);
+
+private:
+    mode m;
+    std::vector<uint8_t> key;
+    crypto_aead_aes256gcm_state aes_state;  // Expanded key, for aead_aes256_gcm
+    uint32_t counter;                       // Nonce of the lite and AES-GCM modes
+
+    int encrypt_aes256gcm(uint8_t *packet, const uint8_t *payload, size_t size);
+    void write_counter(uint8_t *nonce);  // Big endian, then increments the counter
+};
+}  // namespace crypto
 }  // namespace discord
 
 #endif
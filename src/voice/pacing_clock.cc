@@ -0,0 +1,57 @@
+#include <sstream>
+
+#include "voice/pacing_clock.h"
+
+discord::pacing_clock::pacing_clock() : anchored{false}, samples_sent{0}, skips{0}, jitter{} {}
+
+void discord::pacing_clock::reset()
+{
+    anchored = false;
+}
+
+discord::pacing_clock::clock::time_point discord::pacing_clock::sent(int samples)
+{
+    auto now = clock::now();
+    if (!anchored) {
+        anchored = true;
+        anchor = now;
+        deadline = now;
+        samples_sent = 0;
+    }
+
+    auto lateness = now - deadline;
+    record(lateness);
+    if (lateness > max_catch_up) {
+        // Start over from now, rather than rushing through the missed frames
+        anchor = now;
+        samples_sent = 0;
+        skips++;
+    }
+
+    samples_sent += samples;
+    deadline = anchor + std::chrono::microseconds{samples_sent * 1000 / 48};
+    return deadline;
+}
+
+std::string discord::pacing_clock::stats() const
+{
+    auto out = std::ostringstream{};
+    out << "jitter";
+    for (auto i = size_t{0}; i < jitter.size(); i++) {
+        if (i < jitter_bounds_us.size())
+            out << " <" << jitter_bounds_us[i] / 1000.0 << "ms: " << jitter[i];
+        else
+            out << " later: " << jitter[i];
+    }
+    out << ", " << skips << " skips";
+    return out.str();
+}
+
+void discord::pacing_clock::record(clock::duration lateness)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(lateness).count();
+    auto bucket = size_t{0};
+    while (bucket < jitter_bounds_us.size() && us >= jitter_bounds_us[bucket])
+        bucket++;
+    jitter[bucket]++;
+}
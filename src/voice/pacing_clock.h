@@ -0,0 +1,50 @@
+#ifndef DISCORD_VOICE_PACING_CLOCK_H
+#define DISCORD_VOICE_PACING_CLOCK_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace discord
+{
+// Absolute send deadlines for a voice connection's frames. Deadlines are anchored to when the
+// stream (re)started, the nth frame is due at start + the samples sent before it, so timer
+// latency never adds up to drift. A sender that's a little late catches up by sending frames back
+// to back, one that is too late to catch up without audibly rushing skips the deadlines it missed
+class pacing_clock
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    pacing_clock();
+
+    // Forget the anchor, the next frame sent starts the stream again. E.g. after a pause
+    void reset();
+
+    // Records a frame of samples (at 48kHz) being sent now, returns when the next one is due
+    clock::time_point sent(int samples);
+
+    // Lateness of sent frames, and how many times deadlines were skipped
+    std::string stats() const;
+
+private:
+    // Further behind than this, the missed deadlines are skipped instead of caught up on
+    static constexpr auto max_catch_up = std::chrono::milliseconds{100};
+
+    // Upper bounds of the jitter histogram's buckets, the last one counts anything later
+    static constexpr std::array<int, 7> jitter_bounds_us{500,   1000,  2000, 5000,
+                                                         10000, 20000, 50000};
+
+    bool anchored;
+    clock::time_point anchor;
+    clock::time_point deadline;
+    int64_t samples_sent;
+    int64_t skips;
+    std::array<int64_t, jitter_bounds_us.size() + 1> jitter;
+
+    void record(clock::duration lateness);
+};
+}  // namespace discord
+
+#endif
@@ -1,21 +1,63 @@
 #include <algorithm>
+#include <boost/asio/post.hpp>
 #include <iostream>
 #include <regex>
 #include <set>
 
+#include "audio/cached_source.h"
 #include "audio/file_source.h"
+#include "audio/shared_track_source.h"
+#include "audio/track_producer.h"
 #include "audio/youtube_dl.h"
 #include "gateway.h"
 #include "net/uri.h"
 #include "voice/voice_connector.h"
 #include "voice/voice_gateway.h"
 
-discord::voice_connector::voice_connector(boost::asio::io_context &ctx, ssl::context &tls,
-                                          discord::gateway &gateway)
-    : ctx{ctx}, tls{tls}, gateway{gateway}
+discord::voice_connector::voice_connector(boost::asio::io_context &ctx, const audio_services &audio,
+                                          ssl::context &tls, discord::gateway &gateway)
+    : ctx{ctx}, audio{audio}, tls{tls}, gateway{gateway}
 {
 }
 
+// Runs f on the guild's strand, the context is kept alive until then
+template<typename F>
+static void post_to(const std::shared_ptr<discord::voice_context> &context, F f)
+{
+    boost::asio::post(context->get_strand(),
+                      [context, f = std::move(f)]() mutable { f(*context); });
+}
+
+static const discord::guild *get_guild_from_channel(discord::snowflake channel_id,
+                                                    const discord::gateway_store &store)
+{
+    auto guild_id = store.lookup_channel(channel_id);
+    if (guild_id == 0)
+        return nullptr;
+
+    return store.get_guild(guild_id);
+}
+
+// The bitrate of a voice channel, 0 if it isn't known
+static int channel_bitrate(discord::snowflake channel_id, const discord::gateway_store &store)
+{
+    auto guild = get_guild_from_channel(channel_id, store);
+    if (!guild)
+        return 0;
+
+    // to_find contains channel_id to match with the desired channel to determine the audio
+    // bitrate
+    auto to_find = discord::channel{};
+    to_find.id = channel_id;
+    auto channel = guild->channels.find(to_find);
+    if (channel == guild->channels.end())
+        return 0;
+
+    std::cout << "[voice] '" << channel->name << "' playing at " << (channel->bitrate / 1000)
+              << "Kbps\n";
+    return channel->bitrate;
+}
+
 discord::voice_connector::~voice_connector()
 {
     disconnect();
@@ -24,7 +66,7 @@ discord::voice_connector::~voice_connector()
 void discord::voice_connector::disconnect()
 {
     for (auto &it : voice_map) {
-        it.second->disconnect();
+        post_to(it.second, [](auto &context) { context.disconnect(); });
     }
     voice_map.clear();
 }
@@ -39,12 +81,15 @@ void discord::voice_connector::on_voice_state_update(const nlohmann::json &data)
     }
 
     // Create the context if it doesn't exist
-    if (voice_map.count(state.guild_id) == 0) {
-        voice_map[state.guild_id] =
-            std::make_shared<voice_context>(ctx, gateway.get_gateway_store());
-    }
+    auto &context = voice_map[state.guild_id];
+    if (!context)
+        context = std::make_shared<voice_context>(ctx, audio, state.guild_id);
 
-    voice_map[state.guild_id]->on_voice_state_update(std::move(state));
+    // The gateway_store belongs to this strand, so the bitrate is looked up here
+    auto bitrate = channel_bitrate(state.channel_id, gateway.get_gateway_store());
+    post_to(context, [state = std::move(state), bitrate](auto &context) mutable {
+        context.on_voice_state_update(std::move(state), bitrate);
+    });
 }
 
 void discord::voice_connector::on_voice_server_update(const nlohmann::json &data)
@@ -55,7 +100,10 @@ void discord::voice_connector::on_voice_server_update(const nlohmann::json &data
     if (it == voice_map.end()) {
         return;
     }
-    it->second->on_voice_server_update(std::move(vsu), gateway.get_user_id(), tls);
+    post_to(it->second, [vsu = std::move(vsu), user_id = gateway.get_user_id(),
+                         &tls = tls](auto &context) mutable {
+        context.on_voice_server_update(std::move(vsu), user_id, tls);
+    });
 }
 
 // Listen for guild text messages indicating to join, leave, play, pause, etc.
@@ -72,6 +120,21 @@ void discord::voice_connector::on_message_create(const nlohmann::json &data)
         check_command(msg);
 }
 
+// Parses a track position given as seconds, m:ss or h:mm:ss. The fields are kept short enough
+// that chat input can't overflow them
+static bool parse_position(const std::string &s, std::chrono::milliseconds &position)
+{
+    static auto position_re = std::regex{R"(^(?:(?:(\d{1,2}):)?(\d{1,2}):)?(\d{1,6})$)"};
+    auto matcher = std::smatch{};
+    if (!std::regex_match(s, matcher, position_re))
+        return false;
+
+    auto field = [&](int i) { return matcher.str(i).empty() ? 0LL : std::stoll(matcher.str(i)); };
+    position = std::chrono::hours{field(1)} + std::chrono::minutes{field(2)} +
+               std::chrono::seconds{field(3)};
+    return true;
+}
+
 void discord::voice_connector::check_command(const discord::message &m)
 {
     static auto command_re = std::regex{R"(^:(\S+)(?:\s+(.+))?$)"};
@@ -91,33 +154,27 @@ void discord::voice_connector::check_command(const discord::message &m)
     if (command == "join") {
         join_channel(m, params);
     } else if (it != voice_map.end()) {
-        auto &context = *it->second;
+        auto &context = it->second;
         if (command == "leave") {
-            context.leave_channel();
+            post_to(context, [](auto &context) { context.leave_channel(); });
             leave_voice_server(guild_id);
         } else if (command == "list" || command == "l")
-            context.list_queue();
+            post_to(context, [](auto &context) { context.list_queue(); });
         else if (command == "add" || command == "a")
-            context.add_queue(params);
+            post_to(context, [params](auto &context) { context.add_queue(params); });
         else if (command == "skip" || command == "next")
-            context.skip_current();
-        else if (command == "play")
-            context.play();
+            post_to(context, [](auto &context) { context.skip_current(); });
+        else if (command == "seek") {
+            auto position = std::chrono::milliseconds{};
+            if (parse_position(params, position))
+                post_to(context, [position](auto &context) { context.seek(position); });
+        } else if (command == "play")
+            post_to(context, [](auto &context) { context.play(); });
         else if (command == "pause")
-            context.pause();
+            post_to(context, [](auto &context) { context.pause(); });
     }
 }
 
-static const discord::guild *get_guild_from_channel(discord::snowflake channel_id,
-                                                    const discord::gateway_store &store)
-{
-    auto guild_id = store.lookup_channel(channel_id);
-    if (guild_id == 0)
-        return nullptr;
-
-    return store.get_guild(guild_id);
-}
-
 void discord::voice_connector::join_channel(const discord::message &m,
                                             const std::string &channel_name)
 {
@@ -169,7 +226,7 @@ void discord::voice_connector::join_voice_server(discord::snowflake guild_id,
                                  {"channel_id", channel_str},
                                  {"self_mute", false},
                                  {"self_deaf", false}}}};
-    gateway.send(json.dump(), print_transfer_info);
+    gateway.send(json, print_transfer_info);
 }
 
 void discord::voice_connector::leave_voice_server(discord::snowflake guild_id)
@@ -183,7 +240,7 @@ void discord::voice_connector::leave_voice_server(discord::snowflake guild_id)
                                  {"channel_id", nullptr},
                                  {"self_mute", false},
                                  {"self_deaf", false}}}};
-    gateway.send(json.dump(), print_transfer_info);
+    gateway.send(json, print_transfer_info);
 }
 
 const discord::gateway &discord::voice_connector::get_gateway() const
@@ -191,9 +248,17 @@ const discord::gateway &discord::voice_connector::get_gateway() const
     return gateway;
 }
 
-discord::voice_context::voice_context(boost::asio::io_context &ctx,
-                                      const discord::gateway_store &store)
-    : ctx{ctx}, timer{ctx}, store{store}
+discord::voice_context::voice_context(boost::asio::io_context &ctx, const audio_services &audio,
+                                      discord::snowflake guild_id)
+    : ctx{ctx}
+    , strand{boost::asio::make_strand(ctx)}
+    , audio{audio}
+    , credit{0}
+    , credit_skips{0}
+    , ticking{false}
+    , bitrate{64000}
+    , channel_id{0}
+    , guild_id{guild_id}
 {
 }
 
@@ -204,17 +269,39 @@ discord::voice_context::~voice_context()
 
 void discord::voice_context::disconnect()
 {
-    timer.cancel();
+    stop_sending();
     gateway.reset();
+    stop_frames();
     source.reset();
 }
 
-void discord::voice_context::on_voice_state_update(discord::voice_state state)
+void discord::voice_context::stop_frames()
+{
+    // The worker pool may still be producing frames from the source, wait for it to let go
+    if (frames) {
+        print_frame_stats();
+        frames->stop();
+        frames.reset();
+    }
+}
+
+void discord::voice_context::print_frame_stats()
+{
+    std::cout << "[voice] lookahead " << frames->depth() << "/" << frames->capacity()
+              << " frames, lowest " << frames->min_depth() << ", " << frames->underruns()
+              << " underruns\n";
+    std::cout << "[voice] " << credit_skips << " catch up skips, clock " << audio.clock.stats()
+              << "\n";
+    std::cout << "[voice] udp transport: " << audio.transport.stats() << "\n";
+}
+
+void discord::voice_context::on_voice_state_update(discord::voice_state state,
+                                                   int channel_bitrate)
 {
     channel_id = state.channel_id;
-    guild_id = state.guild_id;
     session_id = std::move(state.session_id);
-    update_bitrate();
+    if (channel_bitrate > 0)
+        bitrate = channel_bitrate;
 }
 
 void discord::voice_context::on_voice_server_update(discord::event::voice_server_update v,
@@ -225,7 +312,8 @@ void discord::voice_context::on_voice_server_update(discord::event::voice_server
         endpoint = std::move(v.endpoint);
 
         // We got all the information needed to connect to a voice gateway
-        gateway = std::make_shared<discord::voice_gateway>(ctx, tls, *this, user_id);
+        gateway = std::make_shared<discord::voice_gateway>(strand, tls, audio.transport, *this,
+                                                           user_id);
 
         std::cout << "[voice] created voice gateway\n";
 
@@ -244,24 +332,6 @@ void discord::voice_context::on_voice_server_update(discord::event::voice_server
     }
 }
 
-void discord::voice_context::update_bitrate()
-{
-    auto guild = get_guild_from_channel(channel_id, store);
-    if (!guild)
-        return;
-
-    // to_find contains channel_id to match with the desired channel to determine the audio
-    // bitrate
-    auto to_find = discord::channel{};
-    to_find.id = channel_id;
-    auto channel = guild->channels.find(to_find);
-    if (channel != guild->channels.end()) {
-        encoder.set_bitrate(channel->bitrate);
-        std::cout << "[voice] '" << channel->name << "' playing at " << (channel->bitrate / 1000)
-                  << "Kbps\n";
-    }
-}
-
 void discord::voice_context::leave_channel()
 {
     if (p_state != voice_context::state::disconnected) {
@@ -293,6 +363,18 @@ void discord::voice_context::skip_current()
     }
 }
 
+void discord::voice_context::seek(std::chrono::milliseconds position)
+{
+    if (p_state != voice_context::state::playing && p_state != voice_context::state::paused)
+        return;
+
+    // The source is seeked on the worker pool, frames queued before the seek are dropped
+    if (frames)
+        frames->seek(position);
+    else
+        std::cerr << "[voice] could not seek to " << position.count() / 1000 << "s\n";
+}
+
 void discord::voice_context::play()
 {
     if (p_state == voice_context::state::playing)
@@ -303,7 +385,7 @@ void discord::voice_context::play()
         next_audio_source();
     } else if (p_state == voice_context::state::paused) {
         p_state = voice_context::state::playing;  // Resume
-        send_next_frame();
+        start_sending();
     }
 }
 
@@ -321,8 +403,11 @@ void discord::voice_context::notify_audio_source_ready(const boost::system::erro
         std::cerr << "[voice] error making audio source: " << ec.message() << "\n";
         return;
     }
+    frames = std::make_shared<frame_queue>(audio.pool, source, audio.lookahead);
+    frames->refill();
+
     p_state = voice_context::state::playing;
-    send_next_frame();
+    start_sending();
 }
 
 void discord::voice_context::next_audio_source()
@@ -342,70 +427,117 @@ void discord::voice_context::next_audio_source()
     static auto valid_youtube_dl_sources =
         std::set<std::string>{"youtube.com", "youtu.be", "www.youtube.com"};
 
-    if (valid_youtube_dl_sources.count(parsed.authority)) {
-        source = std::make_shared<youtube_dl_source>(*this, next);
-        source->prepare();
-    } else if (parsed.scheme == "file") {
-        source = std::make_shared<file_source>(*this, parsed.path);
-        source->prepare();
+    auto on_ready = [weak = weak_from_this()](const auto &ec) {
+        if (auto self = weak.lock())
+            self->notify_audio_source_ready(ec);
+    };
+
+    // Another guild may be playing the track right now, or have played it recently
+    stop_frames();
+    auto key = track_cache::key(next);
+    auto shared = audio.memory_cache.find(key, bitrate);
+    auto stats = audio.memory_cache.stats();
+    std::cout << "[voice] memory cache: " << stats.tracks << " tracks, "
+              << stats.bytes / (1024 * 1024) << "MB, " << stats.hits << " hits, " << stats.misses
+              << " misses, " << stats.evictions << " evictions\n";
+    auto cached = shared.track ? std::string{} : audio.disk_cache.lookup(next, bitrate);
+    if (shared.track) {
+        source = std::make_shared<shared_track_source>(shared.track, shared.producer, on_ready);
+    } else if (!cached.empty()) {
+        source = std::make_shared<cached_source>(cached, on_ready);
+    } else if (valid_youtube_dl_sources.count(parsed.authority) || parsed.scheme == "file") {
+        // Encode the track once, for every guild that plays it while it's in memory
+        auto producer =
+            std::make_shared<track_producer>(ctx, audio.pool, audio.disk_cache, next, bitrate);
+        auto live = std::shared_ptr<audio_source>{};
+        if (parsed.scheme == "file")
+            live = std::make_shared<file_source>(producer->context(), parsed.path);
+        else
+            live = std::make_shared<youtube_dl_source>(producer->context(), next);
+
+        audio.memory_cache.insert(key, {producer->get_track(), producer});
+        source = std::make_shared<shared_track_source>(producer->get_track(), producer, on_ready);
+        producer->start(live);
+    } else {
+        return;
     }
+    source->prepare();
 }
 
-void discord::voice_context::send_next_frame()
+void discord::voice_context::on_tick(int samples)
 {
-    if (p_state != voice_context::state::playing)
+    // A tick posted before the guild was removed from the clock
+    if (!ticking)
         return;
+    if (p_state != voice_context::state::playing) {
+        stop_sending();
+        return;
+    }
+    assert(frames);
+
+    // Catch up on at most 100ms, anything older than that is skipped instead of rushed through
+    const auto max_credit = int64_t{4800};
+    credit += samples;
+    if (credit > max_credit) {
+        credit = max_credit;
+        credit_skips++;
+    }
 
-    assert(source);
-
-    using namespace std::chrono;
-    using namespace std::chrono;
-    static auto last_frame_time = high_resolution_clock::now();
-    static auto last_frame_size = 0;
-
-    auto start = high_resolution_clock::now();
-    auto frame = source->next();
-    auto retrieval_time_us =
-        duration_cast<microseconds>(high_resolution_clock::now() - start).count();
-    auto time_since_last_frame_us = duration_cast<microseconds>(start - last_frame_time).count();
-
-    // auto timer_done_cb = [weak = weak_from_this()](const auto &ec) {
-    auto timer_done_cb = [this](const auto &ec) {
-        if (!ec)
-            send_next_frame();
-    };
-
-    if (!frame.data.empty()) {
-        auto fc = frame.frame_count;
-        if (!(fc == 120 || fc == 240 || fc == 480 || fc == 960 || fc == 1920 || fc == 2880)) {
-            std::cerr << "[voice] invalid frame size: " << fc << "\n";
+    while (credit > 0) {
+        // Nothing popped means the worker pool hasn't caught up yet, the credit is kept for the
+        // next tick
+        auto underruns = frames->underruns();
+        auto frame = frames->front();
+        if (!frame && frames->underruns() > underruns)
+            std::cerr << "[voice] lookahead ran dry (" << frames->underruns() << " underruns)\n";
+        if (!frame) {
+            frames->refill();
             return;
         }
 
-        auto expected_time_diff = last_frame_size * 1000 / 48;
-        auto time_offset = std::max<int64_t>(time_since_last_frame_us - expected_time_diff, 0);
-
-        // Next timer expires after frame_size / 48000 seconds, or frame size / 48 ms
-        auto expires_us = frame.frame_count * 1000 / 48 - retrieval_time_us - time_offset;
-        timer.expires_after(microseconds(expires_us));
+        // Sent straight from the lookahead queue, the frame is released once it's encrypted
+        auto end_of_source = frame->end_of_source;
+        if (!frame->empty()) {
+            auto fc = frame->frame_count;
+            // Passed through opus packets can hold up to 120ms of frames
+            if (fc <= 0 || fc > 5760 || fc % 120 != 0) {
+                std::cerr << "[voice] invalid frame size: " << fc << "\n";
+                frames->pop();
+                continue;
+            }
+            gateway->play(*frame);
+            credit -= fc;
+        }
+        frames->pop();
+        frames->refill();
+        if (end_of_source) {
+            // Done with the current source, play next entry
+            std::cout << "[voice] sound clip finished\n";
+            stop_sending();
+            gateway->stop();
+            stop_frames();
+            p_state = voice_context::state::connected;
+            play();
+            return;
+        }
+    }
+}
 
-        // Play the frame
-        gateway->play(frame);
-    } else if (!frame.end_of_source) {
-        // Data from source not yet available... try again in a little
-        timer.expires_from_now(microseconds(500));
+void discord::voice_context::start_sending()
+{
+    credit = 0;
+    if (!ticking) {
+        ticking = true;
+        audio.clock.add(shared_from_this());
     }
-    if (frame.end_of_source) {
-        // Done with the current source, play next entry
-        std::cout << "[voice] sound clip finished\n";
-        timer.cancel();
-        gateway->stop();
-        p_state = voice_context::state::connected;
-        play();
+}
+
+void discord::voice_context::stop_sending()
+{
+    if (ticking) {
+        ticking = false;
+        audio.clock.remove(this);
     }
-    last_frame_size = frame.frame_count;
-    last_frame_time = start;
-    timer.async_wait(timer_done_cb);
 }
 
 discord::snowflake discord::voice_context::get_channel_id() const
@@ -438,12 +570,12 @@ void discord::voice_context::set_endpoint(const std::string &s)
     endpoint = s;
 }
 
-discord::opus_encoder &discord::voice_context::get_encoder()
+int discord::voice_context::get_bitrate() const
 {
-    return encoder;
+    return bitrate;
 }
 
-boost::asio::io_context &discord::voice_context::get_io_context()
+const io_strand &discord::voice_context::get_strand() const
 {
-    return ctx;
+    return strand;
 }
@@ -1,13 +1,16 @@
 #ifndef DISCORD_VOICE_CONNECTOR_H
 #define DISCORD_VOICE_CONNECTOR_H
 
-#include <boost/asio/high_resolution_timer.hpp>
+#include <atomic>
 #include <boost/asio/io_context.hpp>
+#include <chrono>
 #include <deque>
+#include <map>
 #include <memory>
 
 #include "aliases.h"
-#include "audio/opus_encoder.h"
+#include "audio/audio_services.h"
+#include "audio/frame_queue.h"
 #include "audio/source.h"
 #include "discord.h"
 #include "gateway_store.h"
@@ -18,23 +21,28 @@ class gateway;
 class voice_gateway;
 class voice_connector;
 
+// One guild's voice connection. Everything but get_strand(), get_guild_id() and get_channel_id()
+// has to be called on its strand
 struct voice_context : std::enable_shared_from_this<voice_context> {
 public:
-    voice_context(boost::asio::io_context &ctx, const discord::gateway_store &store);
+    voice_context(boost::asio::io_context &ctx, const audio_services &audio,
+                  discord::snowflake guild_id);
     ~voice_context();
-    void on_voice_state_update(discord::voice_state s);
+    void on_voice_state_update(discord::voice_state s, int channel_bitrate);
     void on_voice_server_update(discord::event::voice_server_update v, discord::snowflake user_id,
                                 ssl::context &tls);
     void notify_audio_source_ready(const boost::system::error_code &ec);
     void disconnect();
 
-    void send_next_frame();
+    // Called by the audio_clock every tick while playing, sends samples worth of frames
+    void on_tick(int samples);
     void next_audio_source();
     void join_channel(const std::string &s);
     void leave_channel();
     void add_queue(const std::string &s);
     void list_queue();
     void skip_current();
+    void seek(std::chrono::milliseconds position);
     void play();
     void play(const opus_frame &frame);
     void pause();
@@ -46,34 +54,47 @@ public:
     const std::string &get_endpoint() const;
     void set_endpoint(const std::string &s);
 
-    discord::opus_encoder &get_encoder();
-    boost::asio::io_context &get_io_context();
+    int get_bitrate() const;
+    const io_strand &get_strand() const;
 
 private:
     boost::asio::io_context &ctx;
-    boost::asio::high_resolution_timer timer;
+    io_strand strand;
+    audio_services audio;
+
+    // Samples the audio_clock has ticked that haven't been sent yet. Frames longer than a tick
+    // run it negative, underruns leave some to catch up on
+    int64_t credit;
+    int64_t credit_skips;
+    bool ticking;
 
     std::shared_ptr<audio_source> source;
+    std::shared_ptr<frame_queue> frames;
     std::shared_ptr<discord::voice_gateway> gateway;
     std::deque<std::string> music_queue;
 
-    const discord::gateway_store &store;
-    discord::opus_encoder encoder{2, 48000};
-    discord::snowflake channel_id;
-    discord::snowflake guild_id;
+    int bitrate;  // Tracks are encoded for this channel's bitrate
+    std::atomic<discord::snowflake> channel_id;  // Also read by the voice_connector
+    const discord::snowflake guild_id;
 
     std::string session_id;
     std::string token;
     std::string endpoint;
     enum class state { disconnected, connected, playing, paused } p_state;
 
-    void update_bitrate();
+    void start_sending();
+    void stop_sending();
+    void stop_frames();
+    void print_frame_stats();
 };
 
+// Handles the voice events and commands of the main gateway, on its strand, and hands them to the
+// guild's voice_context on the guild's strand
 class voice_connector : public std::enable_shared_from_this<voice_connector>
 {
 public:
-    voice_connector(boost::asio::io_context &ctx, ssl::context &tls, discord::gateway &gateway);
+    voice_connector(boost::asio::io_context &ctx, const audio_services &audio, ssl::context &tls,
+                    discord::gateway &gateway);
     ~voice_connector();
 
     void disconnect();
@@ -84,6 +105,7 @@ public:
 
 private:
     boost::asio::io_context &ctx;
+    audio_services audio;
     ssl::context &tls;
     discord::gateway &gateway;
 
@@ -8,17 +8,19 @@
 #include "voice/voice_connector.h"
 #include "voice/voice_gateway.h"
 
-discord::voice_gateway::voice_gateway(boost::asio::io_context &ctx, ssl::context &tls,
+discord::voice_gateway::voice_gateway(const io_strand &strand, ssl::context &tls,
+                                      discord::udp_transport &transport,
                                       discord::voice_context &voice_context,
                                       discord::snowflake user_id)
-    : ctx{ctx}
+    : strand{strand}
     , voice_context{voice_context}
-    , conn{ctx, tls}
-    , rtp{ctx}
-    , beater{ctx}
+    , conn{std::make_shared<discord::connection>(strand, tls)}
+    , rtp{strand, transport}
+    , beater{strand}
     , user_id{user_id}
     , state{connection_state::disconnected}
-    , is_speaking{false}
+    , speaking_requested{false}
+    , mode{crypto::mode::xsalsa20_poly1305}
 {
     std::cout << "[voice] connecting to gateway " << voice_context.get_endpoint() << " session_id["
               << voice_context.get_session_id() << "] token[" << voice_context.get_token() << "]\n";
@@ -32,12 +34,12 @@ void discord::voice_gateway::connect(error_cb c)
     auto parsed = uri::parse(voice_context.get_endpoint());
     voice_context.set_endpoint(std::move(parsed.authority));
 
-    conn.connect("wss://" + voice_context.get_endpoint() + "/?v=3", [weak = weak_from_this()](
-                                                                        const auto &ec) {
+    conn->connect("wss://" + voice_context.get_endpoint() + "/?v=3", [weak = weak_from_this()](
+                                                                         const auto &ec) {
         if (auto self = weak.lock()) {
             if (ec) {
                 std::cerr << "[voice] websocket connect error: " << ec.message() << "\n";
-                boost::asio::post(self->ctx, [&]() { self->voice_connect_callback(ec); });
+                boost::asio::post(self->strand, [&]() { self->voice_connect_callback(ec); });
             } else {
                 std::cout << "[voice] websocket connected\n";
                 self->state = connection_state::connected;
@@ -50,7 +52,7 @@ void discord::voice_gateway::connect(error_cb c)
 void discord::voice_gateway::disconnect()
 {
     state = connection_state::disconnected;
-    conn.disconnect();
+    conn->disconnect();
 }
 
 void discord::voice_gateway::identify()
@@ -64,7 +66,7 @@ void discord::voice_gateway::identify()
     auto identify_sent_cb = [&](const auto &ec, auto) {
         if (ec) {
             std::cout << "[voice] gateway identify error: " << ec.message() << "\n";
-            boost::asio::post(ctx, [&]() { voice_connect_callback(ec); });
+            boost::asio::post(strand, [&]() { voice_connect_callback(ec); });
         } else {
             std::cout << "[voice] starting event loop\n";
             next_event();
@@ -73,15 +75,16 @@ void discord::voice_gateway::identify()
     send(identify.dump(), identify_sent_cb);
 }
 
-void discord::voice_gateway::send(const std::string &s, transfer_cb c)
+void discord::voice_gateway::send(const std::string &s, transfer_cb c,
+                                   connection::coalesce kind)
 {
-    conn.send(s, c);
+    conn->send(s, std::move(c), kind);
 }
 
 void discord::voice_gateway::next_event()
 {
     if (state == connection_state::connected)
-        conn.read([weak = weak_from_this()](const auto &ec, auto &json) {
+        conn->read([weak = weak_from_this()](const auto &ec, auto &json) {
             if (ec) {
                 std::cerr << "[voice] error: " << ec.message() << "\n";
                 return;
@@ -133,7 +136,7 @@ void discord::voice_gateway::heartbeat()
 {
     // TODO: save the nonce (rand()) and check if it is ACKed
     auto json = nlohmann::json{{"op", static_cast<int>(voice_op::heartbeat)}, {"d", rand()}};
-    send(json.dump(), ignore_transfer);
+    send(json.dump(), ignore_transfer, connection::coalesce::heartbeat);
 }
 
 void discord::voice_gateway::extract_ready_info(nlohmann::json &data)
@@ -141,10 +144,14 @@ void discord::voice_gateway::extract_ready_info(nlohmann::json &data)
     auto ready_info = data.get<discord::voice_ready>();
     rtp.set_ssrc(ready_info.ssrc);
 
+    if (!crypto::choose_mode(ready_info.modes, mode))
+        throw std::runtime_error("No supported voice mode offered");
+    std::cout << "[voice] using encryption mode " << crypto::mode_name(mode) << "\n";
+
     auto connect_cb = [weak = weak_from_this()](const auto &ec) {
         if (auto self = weak.lock()) {
             if (ec) {
-                boost::asio::post(self->ctx, [=]() { self->voice_connect_callback(ec); });
+                boost::asio::post(self->strand, [=]() { self->voice_connect_callback(ec); });
             } else {
                 self->rtp.ip_discovery([weak](const auto &ecc) {
                     if (auto self = weak.lock()) {
@@ -164,17 +171,18 @@ void discord::voice_gateway::extract_ready_info(nlohmann::json &data)
 void discord::voice_gateway::extract_session_info(nlohmann::json &data)
 {
     auto session_info = data.get<discord::voice_session>();
-    if (session_info.mode != "xsalsa20_poly1305")
+    auto session_mode = crypto::mode{};
+    if (!crypto::parse_mode(session_info.mode, session_mode))
         throw std::runtime_error("Unsupported voice mode: " + session_info.mode);
 
     if (session_info.secret_key.size() != 32)
         throw std::runtime_error("Expected 32 byte secret key but got " +
                                  std::to_string(session_info.secret_key.size()));
 
-    rtp.set_secret_key(std::move(session_info.secret_key));
+    rtp.set_cipher(crypto::cipher{session_mode, std::move(session_info.secret_key)});
 
     // We are ready to start speaking!
-    boost::asio::post(ctx, [&]() { voice_connect_callback({}); });
+    boost::asio::post(strand, [&]() { voice_connect_callback({}); });
 }
 
 void discord::voice_gateway::select()
@@ -185,7 +193,7 @@ void discord::voice_gateway::select()
                                            {"data",
                                             {{"address", rtp.get_external_ip()},
                                              {"port", rtp.get_external_port()},
-                                             {"mode", "xsalsa20_poly1305"}}}}}};
+                                             {"mode", crypto::mode_name(mode)}}}}}};
 
     send(select_payload.dump(), ignore_transfer);
 }
@@ -220,7 +228,7 @@ static void do_speak(discord::voice_gateway *vg, transfer_cb c, bool speak)
     // Apparently this _doesnt_ need the ssrc
     auto speaking_payload = nlohmann::json{{"op", static_cast<int>(discord::voice_op::speaking)},
                                            {"d", {{"speaking", speak}, {"delay", 0}}}};
-    vg->send(speaking_payload.dump(), c);
+    vg->send(speaking_payload.dump(), c, discord::connection::coalesce::speaking);
 }
 
 void discord::voice_gateway::start_speaking(transfer_cb c)
@@ -235,21 +243,20 @@ void discord::voice_gateway::stop_speaking(transfer_cb c)
 
 void discord::voice_gateway::play(const opus_frame &frame)
 {
-    if (!is_speaking) {
-        auto speak_sent_cb = [=](const auto &ec, auto) {
-            if (!ec) {
-                is_speaking = true;
-                rtp.send(frame);
-            }
-        };
-        start_speaking(speak_sent_cb);
-    } else {
-        rtp.send(frame);
+    // Requested once per stretch of audio, frames don't wait for the payload to be written
+    if (!speaking_requested) {
+        speaking_requested = true;
+        start_speaking([](const auto &ec, auto) {
+            // Aborted means a newer speaking state took its place
+            if (ec && ec != boost::asio::error::operation_aborted)
+                std::cerr << "[voice] could not send speaking: " << ec.message() << "\n";
+        });
     }
+    rtp.send(frame);
 }
 
 void discord::voice_gateway::stop()
 {
-    is_speaking = false;
+    speaking_requested = false;
     stop_speaking(ignore_transfer);
 }
@@ -21,25 +21,28 @@ struct voice_context;
 class voice_gateway : public std::enable_shared_from_this<voice_gateway>
 {
 public:
-    voice_gateway(boost::asio::io_context &ctx, boost::asio::ssl::context &tls,
-                  discord::voice_context &voice_context, discord::snowflake user_id);
+    voice_gateway(const io_strand &strand, boost::asio::ssl::context &tls,
+                  discord::udp_transport &transport, discord::voice_context &voice_context,
+                  discord::snowflake user_id);
     void heartbeat();
-    void send(const std::string &s, transfer_cb c);
+    void send(const std::string &s, transfer_cb c,
+              connection::coalesce kind = connection::coalesce::none);
     void connect(error_cb c);
     void disconnect();
     void play(const opus_frame &frame);
     void stop();
 
 private:
-    boost::asio::io_context &ctx;
+    io_strand strand;  // The guild's
     discord::voice_context &voice_context;
-    discord::connection conn;
+    std::shared_ptr<discord::connection> conn;
     discord::rtp_session rtp;
     discord::heartbeater beater;
     discord::snowflake user_id;
 
     enum class connection_state { disconnected, connected } state;
-    bool is_speaking;
+    bool speaking_requested;  // Set as soon as speaking is queued, not once it is written
+    crypto::mode mode;  // Chosen from the modes in the ready payload
     error_cb voice_connect_callback;
 
     void start_speaking(transfer_cb c);
@@ -0,0 +1,33 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <array>
+#include <vector>
+
+#include "voice/crypto.h"
+
+// Per packet cost of each voice encryption mode, for a 20ms frame at 64kbps
+static void benchmark_mode(discord::crypto::mode mode)
+{
+    auto key = std::vector<uint8_t>(crypto_secretbox_KEYBYTES, 0x42);
+    auto payload = std::vector<uint8_t>(160, 0x17);
+    auto packet = std::array<uint8_t, 12 + 160 + 64>{};
+    auto cipher = discord::crypto::cipher{mode, key};
+
+    REQUIRE(cipher.encrypt(packet.data(), payload.data(), payload.size()) == 0);
+    BENCHMARK(discord::crypto::mode_name(mode))
+    {
+        return cipher.encrypt(packet.data(), payload.data(), payload.size());
+    };
+}
+
+TEST_CASE("voice encryption modes", "[crypto][benchmark]")
+{
+    REQUIRE(sodium_init() >= 0);
+    if (discord::crypto::aes256gcm_available())
+        benchmark_mode(discord::crypto::mode::aead_aes256_gcm);
+    benchmark_mode(discord::crypto::mode::xsalsa20_poly1305_lite);
+    benchmark_mode(discord::crypto::mode::xsalsa20_poly1305);
+    benchmark_mode(discord::crypto::mode::xsalsa20_poly1305_suffix);
+}
@@ -0,0 +1,47 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+
+#include <cstring>
+
+#include "discord.h"
+#include "etf.h"
+#include "guild_fixtures.h"
+
+// Decoding a whole GUILD_CREATE payload, through a json tree and straight into the structs
+TEST_CASE("GUILD_CREATE decoding", "[serial][benchmark]")
+{
+    auto end = guild1_text + std::strlen(guild1_text);
+
+    BENCHMARK("json tree")
+    {
+        auto json = nlohmann::json::parse(guild1_text, end);
+        return json.at("d").get<discord::guild>();
+    };
+
+    BENCHMARK("sax")
+    {
+        auto payload = discord::payload{};
+        auto guild = discord::guild{};
+        discord::parse_guild_create(guild1_text, end, payload, guild);
+        return guild;
+    };
+
+    // The same payload as the gateway would send it with encoding=etf
+    auto encoded = discord::etf::dump(with_integer_snowflakes(nlohmann::json::parse(guild1_text)));
+    auto begin = reinterpret_cast<const uint8_t *>(encoded.data());
+
+    BENCHMARK("etf tree")
+    {
+        auto json = discord::etf::parse(begin, begin + encoded.size());
+        return json.at("d").get<discord::guild>();
+    };
+
+    BENCHMARK("etf")
+    {
+        auto payload = discord::payload{};
+        auto guild = discord::guild{};
+        discord::parse_guild_create_etf(begin, begin + encoded.size(), payload, guild);
+        return guild;
+    };
+}
@@ -1,19 +1,20 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 
+#include <boost/filesystem.hpp>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 
+#include "audio/decoding.h"
+#include "audio/track_cache.h"
 #include "discord.h"
+#include "etf.h"
 #include "gateway_store.h"
-
-static const char * guild1_text =  R"EOF({"t":"GUILD_CREATE","s":2,"op":0,"d":{"voice_states":[],"verification_level":0,"unavailable":false,"system_channel_id":null,"splash":null,"roles":[{"position":0,"permissions":104324161,"name":"@everyone","mentionable":false,"managed":false,"id":"179378178601517056","hoist":false,"color":0},{"position":8,"permissions":372759673,"name":"Main","mentionable":false,"managed":false,"id":"188932546241888256","hoist":false,"color":3447003},{"position":6,"permissions":104324161,"name":"Pickles","mentionable":false,"managed":false,"id":"191803649876295680","hoist":true,"color":3066993},{"position":5,"permissions":104324161,"name":"Princess","mentionable":false,"managed":false,"id":"246522587306393600","hoist":true,"color":10181046},{"position":7,"permissions":1073216639,"name":"Admin","mentionable":true,"managed":false,"id":"252375972865638400","hoist":true,"color":15277667},{"position":4,"permissions":298048,"name":"MathBot","mentionable":false,"managed":true,"id":"253679760440426498","hoist":false,"color":0},{"position":3,"permissions":262216,"name":"SwagBot","mentionable":false,"managed":true,"id":"253680791576510464","hoist":false,"color":0},{"position":1,"permissions":1580727409,"name":"Memel0rd","mentionable":false,"managed":false,"id":"348252425976545280","hoist":true,"color":657673},{"position":1,"permissions":37088320,"name":"Okita","mentionable":false,"managed":true,"id":"361042070464626698","hoist":false,"color":0},{"position":1,"permissions":3148800,"name":"TestBot","mentionable":false,"managed":true,"id":"369005484000149505","hoist":false,"color":0}],"region":"us-west","presences":[{"user":{"id":"88444734955094016"},"status":"idle","game":{"type":0,"timestamps":{"start":1509037552824.0},"name":"Destiny 2"}},{"user":{"id":"134073775925886976"},"status":"online","game":{"type":0,"name":"bit.ly/mb-code"}},{"user":{"id":"138363911413039104"},"status":"online","game":{"type":0,"timestamps":{"start":1509039151632.0},"name":"Destiny 2"}},{"user":{"id":"153994498756575232"},"status":"idle","game":null},{"user":{"id":"183442005102297088"},"status":"idle","game":null},{"user":{"id":"188914411631542273"},"status":"online","game":null},{"user":{"id":"190747697588862976"},"status":"idle","game":null},{"user":{"id":"197820932604166145"},"status":"online","game":{"type":0,"timestamps":{"start":1509043134604.0},"name":"Destiny 2"}},{"user":{"id":"197901840791109632"},"status":"idle","game":null},{"user":{"id":"213120617518465036"},"status":"online","game":{"type":0,"timestamps":{"start":1509042091567.0},"name":"Destiny 2"}},{"user":{"id":"214666661763088384"},"status":"idle","game":null},{"user":{"id":"298963480042668032"},"status":"online","game":null},{"user":{"id":"368900250074611725"},"status":"online","game":null}],"owner_id":"147536581748588544","name":"Super Fun Time","mfa_level":0,"members":[{"user":{"username":"TestBot","id":"368900250074611725","discriminator":"7006","bot":true,"avatar":null},"roles":["369005484000149505"],"nick":null,"mute":false,"joined_at":"2017-10-15T06:15:50.765313+00:00","deaf":false},{"user":{"username":"MathBot","id":"134073775925886976","discriminator":"7353","bot":true,"avatar":"970d33bddeb40f9b7a20f7524a6b07f5"},"roles":["253679760440426498"],"mute":false,"joined_at":"2016-12-01T00:32:48.049000+00:00","deaf":false},{"user":{"username":"JesseDean","id":"188929944162664448","discriminator":"9577","avatar":"b22570c9e3546d8c8f996e310d8b5f9b"},"roles":["188932546241888256","191803649876295680","246522587306393600","252375972865638400","348252425976545280"],"mute":false,"joined_at":"2017-02-08T03:14:23.564000+00:00","deaf":false},{"user":{"username":"Anthony","id":"183442005102297088","discriminator":"0080","avatar":"6985cc3345fb03d20eab11c41da1e413"},"roles":[],"mute":false,"joined_at":"2017-05-29T01:48:54.034000+00:00","deaf":false},{"user":{"username":"Speed","id":"147536581748588544","discriminator":"9976","avatar":"ceb7473926b8733d5cd04fa5cdbc40df"},"roles":["188932546241888256","246522587306393600"],"mute":false,"joined_at":"2016-05-09T23:44:50.470000+00:00","deaf":false},{"user":{"username":"Bread","id":"213120617518465036","discriminator":"2429","avatar":"c7d3cd622e6f1f057f8811cc453698f3"},"roles":["188932546241888256","191803649876295680","246522587306393600","252375972865638400","348252425976545280"],"nick":"Brad","mute":false,"joined_at":"2016-08-11T02:25:58.748000+00:00","deaf":false},{"user":{"username":"PattyMelt","id":"191008454125551616","discriminator":"1812","avatar":"dd55e6ead987d9f4e35210c6ec56b1ee"},"roles":[],"mute":false,"joined_at":"2017-04-11T04:48:01.585000+00:00","deaf":false},{"user":{"username":"DrinixGornstead","id":"267835512830689280","discriminator":"6334","avatar":"0032325af3a15e02bc279372fc0a7f3f"},"roles":[],"mute":false,"joined_at":"2017-09-28T22:17:47.234000+00:00","deaf":false},{"user":{"username":"sentrixqt","id":"231943061423390721","discriminator":"1325","avatar":null},"roles":[],"mute":false,"joined_at":"2016-10-02T00:58:55.420000+00:00","deaf":false},{"user":{"username":"HiMommy","id":"182672463644065793","discriminator":"2691","avatar":null},"roles":[],"mute":false,"joined_at":"2016-06-05T07:06:50.694000+00:00","deaf":false},{"user":{"username":"zomow","id":"112721982570713088","discriminator":"3260","avatar":"78c3cdc92dbd15871509f296c8f496a0"},"roles":["191803649876295680","252375972865638400"],"nick":"Caleb","mute":false,"joined_at":"2016-06-06T03:40:29.739000+00:00","deaf":false},{"user":{"username":"HungarianWarlord","id":"183624834083848193","discriminator":"3062","avatar":null},"roles":[],"mute":false,"joined_at":"2016-05-21T16:59:32.093000+00:00","deaf":false},{"user":{"username":"Krisy Pauline","id":"189203394592768000","discriminator":"8294","avatar":"fc8d820254d42f6b146f6afdc72b1767"},"roles":["246522587306393600"],"mute":false,"joined_at":"2016-06-06T03:29:18.690000+00:00","deaf":false},{"user":{"username":"jkirstyn","id":"188912021352218626","discriminator":"2887","avatar":null},"roles":[],"mute":false,"joined_at":"2016-06-05T07:08:55.798000+00:00","deaf":false},{"user":{"username":"sppedwagon A.K.A Swagon","id":"256734024649801728","discriminator":"1507","avatar":"a472547f0a6c31b3e015ab4b73a8c8c1"},"roles":[],"nick":"Swagon","mute":false,"joined_at":"2017-06-20T08:58:12.869000+00:00","deaf":false},{"user":{"username":"Shane","id":"88444734955094016","discriminator":"9981","avatar":"aa868cc7c43583baaaa049a5f0440960"},"roles":[],"mute":false,"joined_at":"2017-02-19T07:54:55.110000+00:00","deaf":false},{"user":{"username":"sensiblemango","id":"121406615227203584","discriminator":"4336","avatar":"7ae0e525a579667eb19f11346b8eb4ce"},"roles":[],"mute":false,"joined_at":"2017-04-12T05:30:00.731000+00:00","deaf":false},{"user":{"username":"Samokato","id":"166727988229046272","discriminator":"0688","avatar":"1d2efabd77b91071f7a821ff758c525a"},"roles":[],"mute":false,"joined_at":"2016-09-12T02:27:23.965000+00:00","deaf":false},{"user":{"username":"Frederick","id":"189268582163546112","discriminator":"5916","avatar":null},"roles":[],"mute":false,"joined_at":"2016-06-06T06:45:46.455000+00:00","deaf":false},{"user":{"username":"SwagBot","id":"217065780078968833","discriminator":"7407","bot":true,"avatar":"f05d6a7e1b9929c45f989136d3acf7c0"},"roles":["253680791576510464"],"mute":false,"joined_at":"2016-12-01T00:36:53.861000+00:00","deaf":false},{"user":{"username":"Coborex","id":"190749424719364096","discriminator":"0543","avatar":"18431d6b8f486e5fccbaa9a2ac8c209f"},"roles":[],"nick":"Cody","mute":false,"joined_at":"2016-06-10T08:50:45.090000+00:00","deaf":false},{"user":{"username":"Triforce_4121","id":"197901840791109632","discriminator":"9466","avatar":"ccca11f1a122887a6915e663bba56717"},"roles":["191803649876295680","252375972865638400","246522587306393600","348252425976545280","188932546241888256"],"nick":"Matt","mute":false,"joined_at":"2017-02-16T05:56:50.890000+00:00","deaf":false},{"user":{"username":"Spore🦎","id":"297952711012515841","discriminator":"6476","avatar":"a27fc4e3cd245ec015b29a49924465a6"},"roles":[],"mute":false,"joined_at":"2017-09-28T03:51:46.977000+00:00","deaf":false},{"user":{"username":"hi","id":"188908425864806400","discriminator":"6227","avatar":null},"roles":[],"mute":false,"joined_at":"2016-06-10T08:30:34.188000+00:00","deaf":false},{"user":{"username":"Got Drums","id":"141439445692841984","discriminator":"0795","avatar":"f5a63ef00b468d52cd6ef70379070e42"},"roles":[],"mute":false,"joined_at":"2017-09-12T06:48:09.091000+00:00","deaf":false},{"user":{"username":"MrBubbles","id":"153994498756575232","discriminator":"2478","avatar":"6ec483749f30298b9c98cd3e28fb6f56"},"roles":[],"mute":false,"joined_at":"2016-05-21T16:58:23.542000+00:00","deaf":false},{"user":{"username":"Okita","id":"298963480042668032","discriminator":"9055","bot":true,"avatar":"2936901c5e266554de73e059a7a40542"},"roles":["361042070464626698"],"mute":false,"joined_at":"2017-09-23T06:52:17.422000+00:00","deaf":false},{"user":{"username":"daichi","id":"207742764765413377","discriminator":"7719","avatar":"9499338042d6f7506b59ae5af4f82401"},"roles":[],"mute":false,"joined_at":"2016-07-28T07:37:32.161000+00:00","deaf":false},{"user":{"username":"Sentrix(센릭)","id":"97819883168862208","discriminator":"1253","avatar":"955798fdb66e5646344b347a78a3fddb"},"roles":["188932546241888256","191803649876295680","246522587306393600","252375972865638400","348252425976545280"],"nick":"Sentrix (센릭)","mute":false,"joined_at":"2016-06-05T07:06:43.831000+00:00","deaf":false},{"user":{"username":"cHaoTic","id":"197820932604166145","discriminator":"6384","avatar":null},"roles":[],"mute":false,"joined_at":"2017-08-24T23:07:54.631000+00:00","deaf":false},{"user":{"username":"jkirstyn","id":"188914411631542273","discriminator":"8812","avatar":"adc7cf1c1dbf5694bf80fc827fd5199e"},"roles":["188932546241888256","246522587306393600"],"mute":false,"joined_at":"2016-06-05T07:25:24.320000+00:00","deaf":false},{"user":{"username":"Zyrox","id":"190747697588862976","discriminator":"3729","avatar":"3af140546aec6d589f1f33a43ca9adc2"},"roles":[],"nick":"Edward Rickenshire","mute":false,"joined_at":"2016-06-10T08:45:07.612000+00:00","deaf":false},{"user":{"username":"Ivi","id":"100364630555107328","discriminator":"5148","avatar":"20384127158cb80ccf36b35c2141107b"},"roles":[],"mute":false,"joined_at":"2017-07-02T06:51:05.378000+00:00","deaf":false},{"user":{"username":"Chairman Moo","id":"138363911413039104","discriminator":"1529","avatar":"a8fe1761ff7de5256c482c38d9b9c60d"},"roles":[],"mute":false,"joined_at":"2016-08-11T22:09:11.189000+00:00","deaf":false},{"user":{"username":"Mochi","id":"214666661763088384","discriminator":"4715","avatar":null},"roles":[],"mute":false,"joined_at":"2017-10-24T07:52:09.218272+00:00","deaf":false},{"user":{"username":"Milarky","id":"176481966059683841","discriminator":"0166","avatar":"abe3525f100abecdad9d74010fd0daf8"},"roles":["188932546241888256","348252425976545280"],"mute":false,"joined_at":"2016-05-09T23:45:19.810000+00:00","deaf":false},{"user":{"username":"Zcampbell24","id":"191044188232482816","discriminator":"2439","avatar":"0833eae7be1d1e94fd1580bd4e535682"},"roles":[],"mute":false,"joined_at":"2017-04-19T01:23:09.084000+00:00","deaf":false},{"user":{"username":"Canadian Slayer","id":"190744297736241152","discriminator":"2974","avatar":null},"roles":[],"mute":false,"joined_at":"2016-06-10T08:29:44.452000+00:00","deaf":false},{"user":{"username":"Aldered","id":"145048273282007041","discriminator":"2086","avatar":null},"roles":[],"mute":false,"joined_at":"2016-09-12T02:28:22.993000+00:00","deaf":false}],"member_count":39,"large":false,"joined_at":"2017-10-15T06:15:50.765313+00:00","id":"179378178601517056","icon":"90313170bd954bef7474c032dc80390c","features":[],"explicit_content_filter":0,"emojis":[{"roles":[],"require_colons":true,"name":"wtf_lol","managed":false,"id":"290008569233932288"},{"roles":[],"require_colons":true,"name":"cana_da","managed":false,"id":"290008949967552514"},{"roles":[],"require_colons":true,"name":"thonk","managed":false,"id":"349055690008166400"},{"roles":[],"require_colons":true,"name":"pepethink","managed":false,"id":"349057342966595605"},{"roles":[],"require_colons":true,"name":"lul","managed":false,"id":"350747232133185538"},{"roles":[],"require_colons":true,"name":"forsene","managed":false,"id":"350782068818575361"},{"roles":[],"require_colons":true,"name":"monkaS","managed":false,"id":"354987507646988288"},{"roles":[],"require_colons":true,"name":"wutface","managed":false,"id":"370724061895983120"}],"default_message_notifications":0,"channels":[{"type":0,"topic":"","position":0,"permission_overwrites":[],"name":"general","last_pin_timestamp":"2017-10-16T04:39:56.428081+00:00","last_message_id":"373081301701623809","id":"179378178601517056"},{"user_limit":0,"type":2,"position":5,"permission_overwrites":[],"name":"General","id":"179378178601517057","bitrate":64000},{"user_limit":0,"type":2,"position":2,"permission_overwrites":[{"type":"role","id":"179378178601517056","deny":0,"allow":0},{"type":"role","id":"191803649876295680","deny":0,"allow":0}],"name":"Speed's Apartment","id":"180054454245130240","bitrate":64000},{"user_limit":0,"type":2,"position":1,"permission_overwrites":[{"type":"role","id":"179378178601517056","deny":805306385,"allow":0}],"name":"Eric's Trucker Stop","id":"183719700826423298","bitrate":64000},{"user_limit":0,"type":2,"position":4,"permission_overwrites":[],"name":"Caleb's Disco","id":"188912035336159232","bitrate":64000},{"user_limit":7,"type":2,"position":6,"permission_overwrites":[],"name":"Jan's Van","id":"188912065820229632","bitrate":64000},{"user_limit":99,"type":2,"position":0,"permission_overwrites":[{"type":"role","id":"179378178601517056","deny":0,"allow":268435456}],"parent_id":null,"nsfw":false,"name":"Bibz's ( friends only )","id":"188928486885294080","bitrate":64000},{"user_limit":0,"type":2,"position":3,"permission_overwrites":[],"name":"Andrew's kpop room","id":"188929561587613696","bitrate":64000},{"type":0,"topic":null,"position":1,"permission_overwrites":[],"name":"seperate_text","last_message_id":"367125839520727041","id":"188931013236359169"},{"user_limit":0,"type":2,"position":7,"permission_overwrites":[],"name":"Evan's Empire","id":"190748337358635009","bitrate":64000},{"user_limit":0,"type":2,"position":8,"permission_overwrites":[],"name":"Cody's Castle","id":"190749861639880704","bitrate":64000},{"user_limit":0,"type":2,"position":9,"permission_overwrites":[],"name":"Krisy's Magical Unicorns","id":"191089659168817154","bitrate":64000},{"user_limit":0,"type":2,"position":10,"permission_overwrites":[],"name":"Daichi's Weeb Mart","id":"215335198777278464","bitrate":64000},{"type":0,"topic":null,"position":2,"permission_overwrites":[],"name":"music-requests","last_message_id":"372281326331494403","id":"361345696554811392"},{"user_limit":0,"type":2,"position":11,"permission_overwrites":[],"name":"Carly's-bat-Cave","id":"362762240132251648","bitrate":64000},{"user_limit":0,"type":2,"position":12,"permission_overwrites":[],"name":"Matt's Trifecta","id":"367864971083907073","bitrate":64000}],"application_id":null,"afk_timeout":300,"afk_channel_id":null}}
-)EOF";
-
-static const char *guild2_text = R"EOF({"t":"GUILD_CREATE","s":3,"op":0,"d":{"voice_states":[],"verification_level":0,"unavailable":false,"system_channel_id":null,"splash":null,"roles":[{"position":0,"permissions":104324161,"name":"@everyone","mentionable":false,"managed":false,"id":"312472384026181632","hoist":false,"color":0}],"region":"us-west","presences":[{"user":{"id":"368900250074611725"},"status":"online","game":null}],"owner_id":"112721982570713088","name":"blahblah","mfa_level":0,"members":[{"user":{"username":"zomow","id":"112721982570713088","discriminator":"3260","avatar":"78c3cdc92dbd15871509f296c8f496a0"},"roles":[],"mute":false,"joined_at":"2017-05-12T06:13:41.811000+00:00","deaf":false},{"user":{"username":"FckYouCaleb","id":"312471795649216512","discriminator":"6247","avatar":null},"roles":[],"nick":"CalebVotedForTrump","mute":false,"joined_at":"2017-05-12T06:17:08.330000+00:00","deaf":false},{"user":{"username":"Sinthrax","id":"312472611307388928","discriminator":"8185","avatar":null},"roles":[],"mute":false,"joined_at":"2017-05-12T06:15:41.379000+00:00","deaf":false},{"user":{"username":"TestBot","id":"368900250074611725","discriminator":"7006","bot":true,"avatar":null},"roles":[],"mute":false,"joined_at":"2017-10-14T23:21:44.088000+00:00","deaf":false}],"member_count":4,"large":false,"joined_at":"2017-10-14T23:21:44.088000+00:00","id":"312472384026181632","icon":null,"features":[],"explicit_content_filter":0,"emojis":[],"default_message_notifications":0,"channels":[{"type":0,"topic":null,"position":0,"permission_overwrites":[],"name":"general","last_message_id":"372921992036352002","id":"312472384026181632"},{"user_limit":0,"type":2,"position":0,"permission_overwrites":[],"name":"General","id":"312472384026181633","bitrate":64000}],"application_id":null,"afk_timeout":300,"afk_channel_id":null}}
-)EOF";
-
+#include "guild_fixtures.h"
+#include "snowflake_map.h"
+#include "voice/crypto.h"
 
 TEST_CASE("guild serialization", "[serial]")
 {
@@ -50,3 +51,442 @@ TEST_CASE("gateway_store", "[serial]")
     guild_id = store.lookup_channel(312472384026181633);
     REQUIRE(312472384026181632 ==guild_id);
 }
+
+static void require_same_guild(const discord::guild &a, const discord::guild &b)
+{
+    REQUIRE(a.id == b.id);
+    REQUIRE(a.owner == b.owner);
+    REQUIRE(a.name == b.name);
+    REQUIRE(a.region == b.region);
+    REQUIRE(a.unavailable == b.unavailable);
+
+    REQUIRE(a.members.size() == b.members.size());
+    for (auto ai = a.members.begin(), bi = b.members.begin(); ai != a.members.end(); ++ai, ++bi) {
+        REQUIRE(ai->user.id == bi->user.id);
+        REQUIRE(ai->user.name == bi->user.name);
+        REQUIRE(ai->user.discriminator == bi->user.discriminator);
+        REQUIRE(ai->nick == bi->nick);
+    }
+
+    REQUIRE(a.channels.size() == b.channels.size());
+    for (auto ai = a.channels.begin(), bi = b.channels.begin(); ai != a.channels.end();
+         ++ai, ++bi) {
+        REQUIRE(ai->id == bi->id);
+        REQUIRE(ai->guild_id == bi->guild_id);
+        REQUIRE(ai->user_limit == bi->user_limit);
+        REQUIRE(ai->bitrate == bi->bitrate);
+        REQUIRE(ai->type == bi->type);
+        REQUIRE(ai->name == bi->name);
+    }
+
+    REQUIRE(a.voice_states.size() == b.voice_states.size());
+    for (auto ai = a.voice_states.begin(), bi = b.voice_states.begin();
+         ai != a.voice_states.end(); ++ai, ++bi) {
+        REQUIRE(ai->channel_id == bi->channel_id);
+        REQUIRE(ai->user_id == bi->user_id);
+        REQUIRE(ai->session_id == bi->session_id);
+        REQUIRE(ai->self_mute == bi->self_mute);
+        REQUIRE(ai->suppress == bi->suppress);
+    }
+}
+
+TEST_CASE("guild sax decoding", "[serial]")
+{
+    for (auto text : {guild1_text, guild2_text}) {
+        auto end = text + std::strlen(text);
+        auto payload = discord::payload{};
+        auto guild = discord::guild{};
+        REQUIRE(discord::parse_guild_create(text, end, payload, guild));
+        REQUIRE(payload.op == discord::gateway_op::dispatch);
+        REQUIRE(payload.event_name == "GUILD_CREATE");
+
+        auto json = nlohmann::json::parse(text, end);
+        REQUIRE(payload.sequence_num == json["s"].get<int>());
+        require_same_guild(guild, json["d"].get<discord::guild>());
+    }
+
+    // Voice states aren't in the recorded payloads
+    auto text = std::string{
+        R"({"id":"1","name":"g","region":"us-west","unavailable":false,"members":[],"channels":[],)"
+        R"("roles":[{"id":"5"}],"voice_states":[{"channel_id":"2","user_id":"3","session_id":"s",)"
+        R"("member":{"user":{"id":"3"}},"deaf":false,"mute":false,"self_deaf":false,)"
+        R"("self_mute":true,"suppress":false}]})"};
+    auto guild = discord::parse_guild(text.data(), text.data() + text.size());
+    require_same_guild(guild, nlohmann::json::parse(text).get<discord::guild>());
+    REQUIRE(1 == guild.voice_states.size());
+    REQUIRE(guild.voice_states.begin()->self_mute);
+
+    // Anything else is left to the json path
+    auto payload = discord::payload{};
+    auto hello = std::string{R"({"t":null,"s":null,"op":10,"d":{"heartbeat_interval":41250}})"};
+    REQUIRE(
+        !discord::parse_guild_create(hello.data(), hello.data() + hello.size(), payload, guild));
+    auto late = std::string{R"({"d":)"} + text + R"(,"op":0,"s":1,"t":"GUILD_CREATE"})";
+    REQUIRE(!discord::parse_guild_create(late.data(), late.data() + late.size(), payload, guild));
+
+    auto missing = std::string{R"({"id":"1","name":"g","members":[],"channels":[]})"};
+    REQUIRE_THROWS(discord::parse_guild(missing.data(), missing.data() + missing.size()));
+}
+
+TEST_CASE("etf", "[serial]")
+{
+    auto json = nlohmann::json::parse(guild1_text);
+    auto encoded = discord::etf::dump(json);
+    auto begin = reinterpret_cast<const uint8_t *>(encoded.data());
+    REQUIRE(json == discord::etf::parse(begin, begin + encoded.size()));
+
+    auto numbers = nlohmann::json{{"small", 7},
+                                  {"int", -70000},
+                                  {"big", 179378178601517056u},
+                                  {"negative", -(1ll << 40)},
+                                  {"float", 0.5},
+                                  {"list", {1, "a", nullptr}},
+                                  {"empty", nlohmann::json::array()},
+                                  {"flag", true}};
+    encoded = discord::etf::dump(numbers);
+    begin = reinterpret_cast<const uint8_t *>(encoded.data());
+    REQUIRE(numbers == discord::etf::parse(begin, begin + encoded.size()));
+    REQUIRE_THROWS(discord::etf::parse(begin, begin + encoded.size() - 1));
+}
+
+TEST_CASE("etf guild decoding", "[serial]")
+{
+    for (auto text : {guild1_text, guild2_text}) {
+        auto json = nlohmann::json::parse(text);
+        auto encoded = discord::etf::dump(with_integer_snowflakes(json));
+        auto begin = reinterpret_cast<const uint8_t *>(encoded.data());
+        auto end = begin + encoded.size();
+
+        auto payload = discord::payload{};
+        auto guild = discord::guild{};
+        REQUIRE(discord::parse_guild_create_etf(begin, end, payload, guild));
+        REQUIRE(payload.sequence_num == json["s"].get<int>());
+        require_same_guild(guild, json["d"].get<discord::guild>());
+
+        // from_json takes integer snowflakes too
+        require_same_guild(guild, discord::etf::parse(begin, end)["d"].get<discord::guild>());
+    }
+
+    auto hello = discord::etf::dump({{"op", 10}, {"d", {{"heartbeat_interval", 41250}}}});
+    auto begin = reinterpret_cast<const uint8_t *>(hello.data());
+    auto payload = discord::payload{};
+    auto guild = discord::guild{};
+    REQUIRE(!discord::parse_guild_create_etf(begin, begin + hello.size(), payload, guild));
+}
+
+TEST_CASE("snowflake_map", "[store]")
+{
+    auto map = discord::snowflake_map<int>{};
+    REQUIRE(!map.find(1));
+    REQUIRE(!map.erase(1));
+
+    // Sequential snowflakes, as a burst of channels would have
+    const auto base = discord::snowflake{312472384026181632};
+    for (auto i = 0; i < 1000; i++)
+        map[base + i] = i;
+    REQUIRE(1000 == map.size());
+
+    for (auto i = 0; i < 1000; i += 2)
+        REQUIRE(map.erase(base + i));
+    REQUIRE(500 == map.size());
+    for (auto i = 0; i < 1000; i++) {
+        auto value = map.find(base + i);
+        REQUIRE(static_cast<bool>(value) == (i % 2 == 1));
+        if (value)
+            REQUIRE(i == *value);
+    }
+    REQUIRE_THROWS(map[0]);
+}
+
+TEST_CASE("gateway_store updates", "[store]")
+{
+    auto store = discord::gateway_store{};
+    store.guild_create(nlohmann::json::parse(guild2_text)["d"]);
+    const auto guild_id = discord::snowflake{312472384026181632};
+
+    auto channel = nlohmann::json{{"id", "400"},      {"guild_id", "312472384026181632"},
+                                  {"type", 2},        {"name", "new"},
+                                  {"bitrate", 96000}, {"user_limit", 0}};
+    store.channel_create(channel);
+    REQUIRE(guild_id == store.lookup_channel(400));
+    REQUIRE(3 == store.get_guild(guild_id)->channels.size());
+
+    channel["bitrate"] = 128000;
+    store.channel_update(channel);
+    auto find = discord::channel{};
+    find.id = 400;
+    REQUIRE(128000 == store.get_guild(guild_id)->channels.find(find)->bitrate);
+
+    store.channel_delete(channel);
+    REQUIRE(0 == store.lookup_channel(400));
+    REQUIRE(2 == store.get_guild(guild_id)->channels.size());
+
+    auto state = nlohmann::json{{"guild_id", "312472384026181632"},
+                                {"channel_id", "312472384026181633"},
+                                {"user_id", "112721982570713088"},
+                                {"session_id", "abc"}};
+    store.voice_state_update(state);
+    state["channel_id"] = nullptr;
+    store.voice_state_update(state);
+    auto &voice_states = store.get_guild(guild_id)->voice_states;
+    REQUIRE(1 == voice_states.size());
+    REQUIRE(0 == voice_states.begin()->channel_id);
+
+    // A voice state for a guild that isn't known is ignored
+    state["guild_id"] = "1";
+    store.voice_state_update(state);
+    REQUIRE(!store.get_guild(1));
+}
+
+// Writes count bytes, numbered from first, into whatever prepare() hands out
+static void fill(buffer_data &buffer, size_t count, uint8_t first)
+{
+    auto regions = buffer.prepare(count);
+    auto value = first;
+    for (auto &region : regions) {
+        for (auto i = size_t{0}; i < region.size; i++)
+            region.data[i] = value++;
+    }
+    buffer.commit(regions[0].size + regions[1].size);
+}
+
+TEST_CASE("buffer_data", "[audio]")
+{
+    auto buffer = buffer_data{8};
+    REQUIRE(8 == buffer.space());
+
+    // Nothing wraps yet, the free space is one region
+    auto regions = buffer.prepare(5);
+    REQUIRE(5 == regions[0].size);
+    REQUIRE(0 == regions[1].size);
+    fill(buffer, 5, 1);
+    REQUIRE(5 == buffer.size());
+
+    auto out = std::array<uint8_t, 8>{};
+    REQUIRE(3 == buffer.read(out.data(), 3));
+    REQUIRE(1 == out[0]);
+    REQUIRE(3 == out[2]);
+    REQUIRE(2 == buffer.buffered());
+
+    // Retained bytes can be read again
+    buffer.rewind();
+    REQUIRE(5 == buffer.buffered());
+    REQUIRE(3 == buffer.read(out.data(), 3));
+
+    // Releasing drops what was read, the free space then wraps around the end of storage
+    buffer.release();
+    REQUIRE(2 == buffer.size());
+    regions = buffer.prepare(100);
+    REQUIRE(3 == regions[0].size);
+    REQUIRE(3 == regions[1].size);
+    fill(buffer, 6, 6);
+    REQUIRE(0 == buffer.space());
+    REQUIRE(0 == buffer.prepare(1)[0].size);
+
+    // Read back in order, across the split
+    REQUIRE(8 == buffer.read(out.data(), 100));
+    for (auto i = 0; i < 8; i++)
+        REQUIRE(4 + i == out[i]);
+    REQUIRE(0 == buffer.size());
+    REQUIRE(0 == buffer.read(out.data(), 1));
+}
+
+TEST_CASE("buffer_data seek", "[audio]")
+{
+    auto buffer = buffer_data{8};
+    fill(buffer, 6, 0);
+
+    // Anywhere within what is held, while it is retained
+    auto out = uint8_t{};
+    REQUIRE(4 == buffer.seek(4, SEEK_SET));
+    REQUIRE(1 == buffer.read(&out, 1));
+    REQUIRE(4 == out);
+    REQUIRE(2 == buffer.seek(-3, SEEK_CUR));
+    REQUIRE(1 == buffer.read(&out, 1));
+    REQUIRE(2 == out);
+    REQUIRE(6 == buffer.seek(6, SEEK_SET));
+    REQUIRE(-1 == buffer.seek(7, SEEK_SET));
+    REQUIRE(-1 == buffer.seek(0, AVSEEK_SIZE));
+
+    // Released bytes are gone, positions stay those of the stream
+    buffer.seek(3, SEEK_SET);
+    buffer.release();
+    REQUIRE(-1 == buffer.seek(2, SEEK_SET));
+    fill(buffer, 5, 6);
+    REQUIRE(9 == buffer.seek(9, SEEK_SET));
+    REQUIRE(1 == buffer.read(&out, 1));
+    REQUIRE(9 == out);
+    REQUIRE(11 == buffer.seek(1, SEEK_CUR | AVSEEK_FORCE));
+
+    buffer.clear();
+    REQUIRE(0 == buffer.size());
+    REQUIRE(11 == buffer.seek(0, SEEK_CUR));
+}
+
+TEST_CASE("track_cache", "[audio]")
+{
+    namespace fs = boost::filesystem;
+    auto directory = fs::temp_directory_path() / fs::unique_path("track-cache-%%%%-%%%%");
+    auto cache = track_cache{directory.string()};
+    REQUIRE(cache.enabled());
+    REQUIRE(!track_cache{""}.enabled());
+
+    // Links to the same video share a key
+    const auto video = std::string{"youtube-dQw4w9WgXcQ"};
+    REQUIRE(video == track_cache::key("https://www.youtube.com/watch?v=dQw4w9WgXcQ"));
+    REQUIRE(video == track_cache::key("https://www.youtube.com/watch?list=x&v=dQw4w9WgXcQ"));
+    REQUIRE(video == track_cache::key("https://youtu.be/dQw4w9WgXcQ?t=10"));
+    auto key = track_cache::key("file:///music/a.mp3");
+    REQUIRE(20 == key.size());
+    REQUIRE(0 == key.find("url-"));
+    REQUIRE(key != track_cache::key("file:///music/b.mp3"));
+
+    auto track = encoded_track{96000, {}, {}};
+    auto frame = opus_frame{};
+    frame.frame_count = 960;
+    for (auto i = 0; i < 10; i++) {
+        auto bytes = std::vector<uint8_t>(10 + i, static_cast<uint8_t>(i));
+        frame.assign(bytes.data(), bytes.size());
+        track.add(frame);
+    }
+
+    const auto url = std::string{"file:///music/a.mp3"};
+    REQUIRE(cache.lookup(url, 96000).empty());
+    cache.store(url, track);
+
+    // Only channels at the bitrate it was encoded at get it
+    auto path = cache.lookup(url, 96000);
+    REQUIRE(!path.empty());
+    REQUIRE(cache.lookup(url, 64000).empty());
+    REQUIRE(cache.lookup(url, 128000).empty());
+
+    // Header, index and payload, back to back
+    auto file = std::ifstream{path, std::ios::binary};
+    auto contents = std::vector<char>{std::istreambuf_iterator<char>{file}, {}};
+    file.close();
+    auto header = track_file_header{};
+    REQUIRE(contents.size() == sizeof(header) + 10 * sizeof(encoded_frame) + track.payload.size());
+    std::memcpy(&header, contents.data(), sizeof(header));
+    REQUIRE(track_cache::check_header(header));
+    REQUIRE(96000 == header.bitrate);
+    REQUIRE(10 == header.frame_count);
+    REQUIRE(track.payload.size() == header.payload_size);
+
+    auto frames = std::vector<encoded_frame>(10);
+    std::memcpy(frames.data(), contents.data() + sizeof(header), 10 * sizeof(encoded_frame));
+    for (auto i = size_t{0}; i < frames.size(); i++) {
+        REQUIRE(track.frames[i].offset == frames[i].offset);
+        REQUIRE(track.frames[i].size == frames[i].size);
+        REQUIRE(960 == frames[i].frame_count);
+        REQUIRE(track_cache::check_frame(header, frames[i]));
+    }
+    auto payload = contents.data() + sizeof(header) + 10 * sizeof(encoded_frame);
+    REQUIRE(0 == std::memcmp(payload, track.payload.data(), track.payload.size()));
+
+    // Frames outside the payload, or bigger than an opus frame, damage the file
+    auto outside = encoded_frame{header.payload_size - 4, 5, 960};
+    REQUIRE(!track_cache::check_frame(header, outside));
+    auto oversized = encoded_frame{0, opus_frame::max_size + 1, 960};
+    header.payload_size = 4096;
+    REQUIRE(!track_cache::check_frame(header, oversized));
+
+    // A truncated file is a miss, and is removed
+    {
+        auto damaged = std::ofstream{path, std::ios::binary | std::ios::trunc};
+        damaged.write(contents.data(), contents.size() - 1);
+    }
+    REQUIRE(cache.lookup(url, 96000).empty());
+    REQUIRE(!fs::exists(path));
+
+    fs::remove_all(directory);
+}
+
+// Encrypts payload after a copy of header, which has to come out unchanged
+static std::vector<uint8_t> encrypt_packet(discord::crypto::cipher &cipher,
+                                           const std::vector<uint8_t> &header,
+                                           const std::vector<uint8_t> &payload)
+{
+    auto packet = std::vector<uint8_t>(header.size() + cipher.overhead() + payload.size());
+    std::memcpy(packet.data(), header.data(), header.size());
+    REQUIRE(0 == cipher.encrypt(packet.data(), payload.data(), payload.size()));
+    REQUIRE(0 == std::memcmp(packet.data(), header.data(), header.size()));
+    return packet;
+}
+
+static uint32_t read_counter(const uint8_t *nonce)
+{
+    return (uint32_t{nonce[0]} << 24) | (uint32_t{nonce[1]} << 16) | (uint32_t{nonce[2]} << 8) |
+           uint32_t{nonce[3]};
+}
+
+TEST_CASE("voice encryption", "[crypto]")
+{
+    using discord::crypto::mode;
+
+    REQUIRE(sodium_init() >= 0);
+    auto key = std::vector<uint8_t>(crypto_secretbox_KEYBYTES);
+    randombytes_buf(key.data(), key.size());
+    auto header = std::vector<uint8_t>{0x80, 0x78, 0x00, 0x01, 0x00, 0x00, 0x03, 0xC0,
+                                       0x00, 0x00, 0x00, 0x2A};
+    auto payload = std::vector<uint8_t>(160);
+    for (auto i = size_t{0}; i < payload.size(); i++)
+        payload[i] = static_cast<uint8_t>(i);
+
+    // MAC after the header, then the audio, then the nonce if the mode appends one
+    const auto modes = {mode::xsalsa20_poly1305_lite, mode::xsalsa20_poly1305,
+                        mode::xsalsa20_poly1305_suffix};
+    for (auto m : modes) {
+        auto cipher = discord::crypto::cipher{m, key};
+        auto counters = std::vector<uint32_t>{};
+        for (auto n = 0; n < 2; n++) {
+            auto packet = encrypt_packet(cipher, header, payload);
+            REQUIRE(packet.size() == header.size() + cipher.overhead() + payload.size());
+
+            auto mac = packet.data() + header.size();
+            auto audio = mac + crypto_secretbox_MACBYTES;
+            auto suffix = audio + payload.size();
+            auto nonce = std::vector<uint8_t>(crypto_secretbox_NONCEBYTES);
+            if (m == mode::xsalsa20_poly1305_lite) {
+                std::memcpy(nonce.data(), suffix, 4);
+                counters.push_back(read_counter(suffix));
+            } else if (m == mode::xsalsa20_poly1305) {
+                std::memcpy(nonce.data(), header.data(), header.size());
+            } else {
+                std::memcpy(nonce.data(), suffix, nonce.size());
+            }
+
+            auto opened = std::vector<uint8_t>(payload.size());
+            REQUIRE(0 == crypto_secretbox_open_detached(opened.data(), audio, mac, payload.size(),
+                                                        nonce.data(), key.data()));
+            REQUIRE(opened == payload);
+        }
+        if (m == mode::xsalsa20_poly1305_lite)
+            REQUIRE(counters[1] == counters[0] + 1);
+    }
+
+    // Only with hardware AES: audio after the header, then the tag and the counter. The header is
+    // authenticated, and the nonce is the counter followed by 0s
+    if (!discord::crypto::aes256gcm_available())
+        return;
+    auto cipher = discord::crypto::cipher{mode::aead_aes256_gcm, key};
+    auto counters = std::vector<uint32_t>{};
+    for (auto n = 0; n < 2; n++) {
+        auto packet = encrypt_packet(cipher, header, payload);
+        REQUIRE(packet.size() == header.size() + cipher.overhead() + payload.size());
+
+        auto audio = packet.data() + header.size();
+        auto tag = audio + payload.size();
+        auto suffix = tag + crypto_aead_aes256gcm_ABYTES;
+        auto nonce = std::vector<uint8_t>(crypto_aead_aes256gcm_NPUBBYTES);
+        std::memcpy(nonce.data(), suffix, 4);
+        counters.push_back(read_counter(suffix));
+
+        auto opened = std::vector<uint8_t>(payload.size());
+        REQUIRE(0 == crypto_aead_aes256gcm_decrypt_detached(opened.data(), nullptr, audio,
+                                                            payload.size(), tag, header.data(),
+                                                            header.size(), nonce.data(),
+                                                            key.data()));
+        REQUIRE(opened == payload);
+    }
+    REQUIRE(counters[1] == counters[0] + 1);
+}